@@ -9,7 +9,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
+#ifdef __linux__
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "clock.h"
 
 
@@ -179,6 +186,135 @@ double ovhd()
     return result;
 }
 
+/*
+ * read_ticks - the time stamp counter on x86, which is cheap enough to
+ *     read around every request of a trace; nanoseconds of the
+ *     monotonic clock elsewhere
+ */
+unsigned long long read_ticks(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* ticks_per_nsec - rate of read_ticks, against the clock over 10 ms */
+double ticks_per_nsec(void)
+{
+    static double rate = 0;
+    struct timespec start, now;
+    unsigned long long t0, t1;
+    double ns;
+
+    if (rate > 0)
+	return rate;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    t0 = read_ticks();
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = 1e9*(now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec);
+    } while (ns < 1e7);
+    t1 = read_ticks();
+    rate = (t1 - t0) / ns;
+    return rate;
+}
+
+/* ticks_ovhd - least cost of a read_ticks pair, over 1000 tries */
+unsigned long long ticks_ovhd(void)
+{
+    unsigned long long t, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+	t = read_ticks();
+	t = read_ticks() - t;
+	if (t < best)
+	    best = t;
+    }
+    return best;
+}
+
+/*
+ * The perf_event counters behind pmc_start and pmc_stop, opened the
+ * first time a process uses them. A forked child opens its own, as
+ * the ones it inherits count its parent.
+ */
+#ifdef __linux__
+static int pmc_fd[PMC_EVENTS] = {-1, -1, -1};
+static pid_t pmc_pid = 0;
+
+static void pmc_open(void)
+{
+    static const struct { unsigned type; unsigned long long config; } ev[] = {
+	{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) | 
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < PMC_EVENTS; i++) {
+	if (pmc_fd[i] >= 0)
+	    close(pmc_fd[i]);
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = ev[i].type;
+	attr.config = ev[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	pmc_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    pmc_pid = getpid();
+}
+#endif
+
+/* pmc_start - zero the counters and start them */
+void pmc_start(void)
+{
+#ifdef __linux__
+    int i;
+
+    if (pmc_pid != getpid())
+	pmc_open();
+    for (i = 0; i < PMC_EVENTS; i++)
+	if (pmc_fd[i] >= 0) {
+	    ioctl(pmc_fd[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(pmc_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+/* pmc_stop - stop the counters and read them into counts */
+void pmc_stop(long long counts[PMC_EVENTS])
+{
+    int i;
+
+    for (i = 0; i < PMC_EVENTS; i++) {
+	counts[i] = -1;
+#ifdef __linux__
+	if (pmc_fd[i] < 0)
+	    continue;
+	ioctl(pmc_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	if (read(pmc_fd[i], &counts[i], sizeof(counts[i])) != 
+	    sizeof(counts[i]))
+	    counts[i] = -1;
+#endif
+    }
+}
+
 /* $begin mhz */
 /* Estimate the clock rate by measuring the cycles that elapse */ 
 /* while sleeping for sleeptime seconds */
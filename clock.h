@@ -9,6 +9,22 @@ double get_counter();
 /* Measure overhead for counter */
 double ovhd();
 
+/* A cheap 64-bit counter for timing single calls, and its rate */
+unsigned long long read_ticks(void);
+double ticks_per_nsec(void);
+
+/* Smallest number of ticks between two back-to-back reads */
+unsigned long long ticks_ovhd(void);
+
+/* 
+ * Hardware event counts of the calling process between pmc_start and
+ * pmc_stop: cycles, last-level cache misses and dTLB misses, in user
+ * mode only. An event the kernel or cpu won't count reads as -1.
+ */
+#define PMC_EVENTS 3
+void pmc_start(void);
+void pmc_stop(long long counts[PMC_EVENTS]);
+
 /* Determine clock rate of processor (using a default sleeptime) */
 double mhz(int verbose);
 
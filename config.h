@@ -53,9 +53,9 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes (16, what SSE and AVX loads need) 
  */
-#define ALIGNMENT 8  
+#define ALIGNMENT 16  
 
 /* 
  * Maximum heap size in bytes 
@@ -65,8 +65,9 @@
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
+#define USE_CLOCK  1   /* clock_gettime w/K-best scheme (Linux) */
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
 #endif /* __CONFIG_H */
@@ -9,6 +9,7 @@
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static double last_median, last_p99; /* spread of the last fsecs runs */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -19,7 +20,10 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
+#if USE_CLOCK
+    if (verbose)
+	printf("Measuring performance with clock_gettime(CLOCK_MONOTONIC_RAW).\n");
+#elif USE_FCYC
     if (verbose)
 	printf("Measuring performance with a cycle counter.\n");
 
@@ -44,7 +48,9 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
+#if USE_CLOCK
+    return ftimer_clock(f, argp, &last_median, &last_p99);
+#elif USE_FCYC
     double cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
 #elif USE_ITIMER
@@ -54,4 +60,15 @@ double fsecs(fsecs_test_funct f, void *argp)
 #endif 
 }
 
+/*
+ * fsecs_spread - The median and 99th percentile running times behind
+ *     the last fsecs result. Return 0 if the timer doesn't keep them.
+ */
+int fsecs_spread(double *median, double *p99)
+{
+    *median = last_median;
+    *p99 = last_p99;
+    return USE_CLOCK;
+}
+
 
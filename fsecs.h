@@ -2,3 +2,4 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+int fsecs_spread(double *median, double *p99);
@@ -7,11 +7,26 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_clock: version that uses clock_gettime and a K-best scheme
  */
+#define _GNU_SOURCE  /* for sched_getcpu and the CPU_ macros */
 #include <stdio.h>
+#include <sched.h>
+#include <time.h>
 #include <sys/time.h>
 #include "ftimer.h"
 
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
+/* Parameters of ftimer_clock */
+#define CLOCK_WARMUP       2 /* untimed runs before the first sample */
+#define CLOCK_K            3 /* value of K in the K-best scheme, as in fcyc */
+#define CLOCK_EPSILON   0.01 /* K best samples should be EPSILON of each other */
+#define CLOCK_MINSAMPLES  11 /* enough samples for a median and a tail */
+#define CLOCK_MAXSAMPLES 101 /* give up on converging after this many */
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
@@ -53,6 +68,57 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/* 
+ * ftimer_clock - Use CLOCK_MONOTONIC_RAW to estimate the running time
+ * of f(argp), pinned to the CPU we start on, after a few warmup runs.
+ * Samples are taken until the K smallest agree within epsilon, as in
+ * fcyc. Return the smallest, along with the median and 99th
+ * percentile of all the samples.
+ */
+double ftimer_clock(ftimer_test_funct f, void *argp, 
+		    double *median, double *p99)
+{
+    static double samples[CLOCK_MAXSAMPLES]; /* in increasing order */
+    struct timespec stv, etv;
+    cpu_set_t old_cpus, cpu;
+    int i, n, pinned;
+    double val;
+
+    /* Keep to one core, so the clock and the caches stay the same */
+    pinned = sched_getaffinity(0, sizeof(old_cpus), &old_cpus) == 0;
+    if (pinned) {
+	CPU_ZERO(&cpu);
+	CPU_SET(sched_getcpu(), &cpu);
+	pinned = sched_setaffinity(0, sizeof(cpu), &cpu) == 0;
+    }
+
+    for (i = 0; i < CLOCK_WARMUP; i++)
+	f(argp);
+
+    n = 0;
+    do {
+	clock_gettime(CLOCK_MONOTONIC_RAW, &stv);
+	f(argp);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &etv);
+	val = (etv.tv_sec - stv.tv_sec) + 1E-9*(etv.tv_nsec - stv.tv_nsec);
+
+	/* Insertion sort */
+	for (i = n++; i > 0 && samples[i-1] > val; i--)
+	    samples[i] = samples[i-1];
+	samples[i] = val;
+    } while ((n < CLOCK_MINSAMPLES || 
+	      (1 + CLOCK_EPSILON)*samples[0] < samples[CLOCK_K-1]) && 
+	     n < CLOCK_MAXSAMPLES);
+
+    if (pinned)
+	sched_setaffinity(0, sizeof(old_cpus), &old_cpus);
+
+    *median = samples[n/2];
+    *p99 = samples[(99*n + 99)/100 - 1];
+    return samples[0];
+}
+
+
 /*
  * Routines for manipulating the Unix interval timer
  */
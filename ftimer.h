@@ -12,3 +12,9 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Estimate the running time of f(argp) using CLOCK_MONOTONIC_RAW
+   and a K-best scheme. Return the best run, and the median and 99th
+   percentile of the runs in *median and *p99 */
+double ftimer_clock(ftimer_test_funct f, void *argp, 
+		    double *median, double *p99);
+
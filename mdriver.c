@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for sched_setaffinity and the CPU_ macros */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,11 +15,20 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
 #include "config.h"
 
 /**********************
@@ -29,19 +39,44 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BIN_MAGIC "MMTRACE1" /* first bytes of a binary trace file */
+#define STATS_STEP    64 /* -v takes the heap's stats again once its
+			    payload peak grows by 1/STATS_STEP */
+
+/* Runs of requests replayed through the batch API (-b) */
+#define BATCH_MAX     64 /* longest run handed over in one call */
+#define RANGE_CHUNK 1024 /* range records taken from libc at a time */
+
+/* Multi-threaded replay (-T) */
+#define THREAD_RUNS    3 /* best of this many runs is reported */
+#define DRAIN_EVERY   64 /* ops between mailbox drains with -X */
+#define MAILBOX_MAX  256 /* blocks a mailbox holds before senders wait */
+
+/* Latency histograms (-L) */
+#define LAT_SUB_BITS   3 /* each power of two is split in 2^LAT_SUB_BITS */
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS (64 * LAT_SUB)
+#define LAT_WORST      5 /* slowest requests reported per op type */
+#define CACHE_LINE    64 /* bytes between the reads of a -C walk */
+
+/* Synthetic workloads (-G) */
+#define GEN_ROWS      10 /* lines in the report of a run, by default */
+#define GEN_IDS     1024 /* ids the generator makes room for at first */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((size_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, in an AVL tree by address */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges at lower addresses */
+    struct range_t *right; /* ranges at higher addresses; free list link */
+    int height;            /* height of the subtree rooted here */
 } range_t;
 
 /* Characterizes a single trace operation (allocator request) */
@@ -60,8 +95,62 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    size_t map_len;      /* if nonzero, ops lies in a mapped binary file */
 } trace_t;
 
+/* 
+ * Header of a binary trace: the ops follow it as a packed traceop_t
+ * array, so a mapped file is replayed in place. The format is that of
+ * the host that wrote it; op_size guards against reading it elsewhere.
+ */
+typedef struct {
+    char magic[8];       /* BIN_MAGIC */
+    int op_size;         /* sizeof(traceop_t) on the writing host */
+    int sugg_heapsize;   /* header fields of the .rep file... */
+    int num_ids;
+    int num_ops;
+    int weight;          /* ... ending here */
+    int pad;             /* keeps the ops 8-byte aligned */
+} bintrace_t;
+
+/*
+ * The settings the tuner (-S) tries, each with the set_policy tokens
+ * of its values. The first value of each is where the search starts,
+ * so together they spell out the defaults of mm.c.
+ */
+#define TUNE_VALUES 6        /* most values per setting */
+#define TUNE_ROUNDS 3        /* most passes over all the settings */
+typedef struct {
+    char *name;
+    char *values[TUNE_VALUES + 1];  /* NULL-terminated */
+} knob_t;
+static knob_t knobs[] = {
+    {"fit",   {"good", "first", "next", "best", NULL}},
+    {"order", {"lifo", "addr", NULL}},
+    {"lists", {"seg", "single", NULL}},
+    {"slab",  {"slab=64", "slab=32", "slab=0", NULL}},
+    {"split", {"split=0", "split=32", "split=64", "split=128", "split=256", 
+	       NULL}},
+    {"chunk", {"chunk=256", "chunk=1024", "chunk=4096", "chunk=16384", NULL}},
+    {"quick", {"quick=0", "quick=64", "quick=128", "quick=256", "quick=512",
+	       NULL}},
+};
+#define NUM_KNOBS ((int)(sizeof(knobs) / sizeof(knobs[0])))
+
+/* 
+ * A sample of the heap taken during eval_mm_util's replay (-u). In a
+ * binary timeline the samples follow SAMPLE_MAGIC as a packed array.
+ */
+#define SAMPLE_MAGIC "MMUTIL01"
+typedef struct {
+    int trace;           /* trace number */
+    int op;              /* requests replayed so far */
+    long live;           /* payload bytes allocated */
+    long heap;           /* bytes the allocator got from memlib */
+    long free_blocks;    /* from mm_stats, -1 without MM_STATS... */
+    long largest_free;   /* ... and the biggest of those blocks */
+} sample_t;
+
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -70,6 +159,9 @@ typedef struct {
 typedef struct {
     trace_t *trace;  
     range_t *ranges;
+    struct lathist *lat; /* if set, per-op latencies go here, by op type */
+    int walk;            /* if set, payloads are written, and the live ones
+			    read back every walk requests */
 } speed_t;
 
 /* Summarizes the important stats for some malloc function on some trace */
@@ -78,6 +170,8 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double median;   /* median and... */
+    double p99;      /* ... 99th percentile secs over the timed runs */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
@@ -85,6 +179,81 @@ typedef struct {
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* A run of mallocs of one size, or of frees, being replayed (-b) */
+typedef struct {
+    char *ptrs[BATCH_MAX]; /* blocks the run got from mm_malloc_batch */
+    int next;              /* next of them to hand out */
+    int left;              /* requests of the run not yet replayed */
+} batch_t;
+
+/* Blocks handed to a thread for it to free (-X) */
+typedef struct {
+    pthread_mutex_t lock;
+    char **blocks;       /* pointers waiting to be freed */
+    int count;           /* number of waiting pointers */
+    int max;             /* capacity of the blocks array */
+    int closed;          /* owner is done replaying; no limit on count */
+} mailbox_t;
+
+/* The state of one thread of a multi-threaded replay */
+typedef struct {
+    trace_t *trace;      /* trace being replayed (shared, read only) */
+    int id;              /* thread number, 0..nthreads-1 */
+    int nthreads;        /* number of threads in this run */
+    char **blocks;       /* this thread's ptrs, indexed by trace id... */
+    int *block_sizes;    /* ... and their payload sizes */
+    pthread_t tid;
+    int ops;             /* requests issued by this thread */
+    double start, end;   /* wall-clock times it started and finished */
+    int failed;          /* set if a request failed or a payload was hit */
+} thread_t;
+
+/* Log-linear histogram of the ticks taken by one type of request */
+typedef struct lathist {
+    unsigned long count[LAT_BUCKETS];
+    unsigned long n;                /* requests timed */
+    unsigned long long max;         /* ticks taken by the slowest */
+    unsigned long long worst[LAT_WORST]; /* the slowest few, slowest first... */
+    int worst_op[LAT_WORST];        /* ... and their request numbers */
+} lathist_t;
+
+/* A distribution of request sizes for -G */
+typedef struct {
+    enum {SIZE_UNIFORM, SIZE_POWER, SIZE_BIMODAL, SIZE_TABLE} kind;
+    double a, lo, hi, p; /* the parameters its kind takes */
+    int *sizes;          /* SIZE_TABLE: the sizes... */
+    double *cum;         /* ... and the running total of their weights */
+    int n;
+} sizedist_t;
+
+/* A synthetic workload (-G), and how far its generator has got */
+typedef struct {
+    long long ops;       /* requests to issue before the last frees */
+    double live;         /* mean lifetime in mallocs: about the live blocks */
+    enum {LIFE_EXP, LIFE_POWER, LIFE_CONST} life;
+    double life_a;       /* shape of a LIFE_POWER lifetime */
+    double realloc_p;    /* chance that a request is a realloc... */
+    double growth;       /* ... and the factor it scales the block by */
+    int max_size;        /* largest block a realloc grows to */
+    unsigned long long seed;
+    int rows;            /* lines in the report of a run */
+    sizedist_t size;
+
+    unsigned long long rng;
+    long long issued;    /* requests so far, not counting the last frees */
+    long long clock;     /* mallocs so far, which lifetimes are counted in */
+    long long *death;    /* by id: the clock at which the block goes... */
+    int *size_of;        /* ... its payload size... */
+    char **blocks;       /* ... and its payload, set by the replay */
+    int *heap;           /* ids of the live blocks, a min-heap by death */
+    int nlive;
+    size_t live_bytes;   /* payload bytes of the live blocks */
+    int *spare;          /* ids of freed blocks, to be handed out again */
+    int nspare;
+    int num_ids;         /* ids handed out, of the cap there is room for */
+    int cap;
+} gen_t;
+
 /********************
  * Global variables
  *******************/
@@ -100,6 +269,30 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+static int batch = 0;             /* use mm_malloc_batch/mm_free_batch (-b) */
+static int sized = 0;             /* free blocks with mm_free_sized (-z) */
+static int use_region = 0;        /* replay each trace into a region (-r) */
+static int spread = 0;            /* the timer reports median and p99 secs */
+static int latency = 0;           /* time every request once more (-L) */
+static int cache_walk = 0;        /* touch the payloads once more (-C) */
+static volatile char cache_sink;  /* what the walks read goes here */
+static int have_stats = 0;        /* mm_stats filled in the two below */
+static mm_stats_t peak_stats;     /* the heap near the trace's payload peak */
+static mm_stats_t end_stats;      /* the counters at the end of the trace */
+static int sample_every = 0;      /* sample the heap every n requests (-u) */
+static FILE *sample_fp = NULL;    /* the timeline the samples go to (-o) */
+static int sample_bin = 0;        /* ... written in binary, not as CSV */
+
+/* Settings and shared state of the multi-threaded replay */
+static int divide_ids = 0;        /* split ids among threads (-D) */
+static int cross_free = 0;        /* free blocks in another thread (-X) */
+static int thread_arenas = 1;     /* MM_ARENAS for the threaded runs (-A) */
+static pthread_barrier_t thread_start, thread_done;
+static mailbox_t *mailboxes;      /* one per thread, only with -X */
+
+/* Range records not in any tree, kept for reuse */
+static range_t *free_ranges = NULL;
+
 
 /********************* 
  * Function prototypes 
@@ -110,9 +303,14 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *range_insert(range_t *t, range_t *n);
+static range_t *range_remove(range_t *t, char *lo, range_t **found);
+static range_t *range_below(range_t *t, char *addr);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, char *path);
+static void write_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,8 +322,69 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges, int threads);
+static void eval_mm_parallel(char **tracefiles, int n, int jobs, 
+			     stats_t *stats, int threads);
+
+/* Replay runs of mallocs and frees through the batch API */
+static int batch_run(trace_t *trace, int i);
+static char *batch_malloc(batch_t *b, trace_t *trace, int i);
+static void batch_free(batch_t *b, trace_t *trace, int i);
+
+/* Replay a trace into one region, freed as a whole at the end */
+static char *region_realloc(mm_region_t *r, char *oldp, int oldsize, 
+			    int size);
+
+/* Per-request latencies */
+static void lat_add(lathist_t *h, unsigned long long ticks, int op);
+static unsigned long long lat_quantile(lathist_t *h, double q);
+static double lat_ns(unsigned long long ticks, unsigned long long ovhd);
+static void print_latency(speed_t *params, int tracenum);
+static void touch_op(trace_t *trace, int i, int walk, int freed);
+static void print_cache(speed_t *params, int tracenum);
+
+/* The allocator's own counters, from mm_stats */
+static void print_heapstats(int tracenum);
+static void open_samples(char *path);
+static void sample_heap(int tracenum, int op, int live);
+
+/* Routines for replaying a trace with several threads at once */
+static double eval_mm_threads(trace_t *trace, int nthreads, 
+			      double *thread_kops);
+static void *replay_thread(void *ptr);
+static void mailbox_put(thread_t *t, char *block);
+static void mailbox_drain(mailbox_t *box);
+static double wall_secs(void);
+static void print_scaling(trace_t *trace, int tracenum, int max_threads);
+
+/* Searching the settings of mm.c for the best perfindex (-S) */
+static void tune(trace_t **traces, int n, int jobs, double weight, 
+		 char *path);
+static void tune_scores(char (*policies)[MAXLINE], int n, double *scores,
+			trace_t **traces, int ntraces, int jobs, 
+			double weight);
+static double tune_score(char *policy, trace_t **traces, int n, 
+			 double weight);
+static void tune_policy(int *cur, char *policy);
+
+/* Synthetic workloads, generated as they are replayed (-G) */
+static int gen_parse(gen_t *g, char *spec);
+static int gen_table(sizedist_t *d, char *kind, char *file);
+static void gen_reset(gen_t *g);
+static int gen_next(gen_t *g, traceop_t *op);
+static void gen_push(gen_t *g, int id);
+static int gen_pop(gen_t *g);
+static double gen_uniform(gen_t *g);
+static int gen_size(gen_t *g);
+static long long gen_life(gen_t *g);
+static void eval_gen(gen_t *g, char *spec);
+static void gen_row(gen_t *g, long long done, long long n, double secs,
+		    size_t peak);
+static void write_gen(gen_t *g, char *path);
 
 /* Various helper routines */
+static int set_policy(char *spec);
 static void printresults(int n, stats_t *stats);
 static void usage(void);
 static void unix_error(char *msg);
@@ -150,6 +409,17 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int seglists = 1;    /* If reset, use a single free list in mm.c (-s) */
+    int threads = 0;     /* If set, also replay with up to this many threads */
+    char *binfile = NULL;/* If set, convert the trace to this binary file */
+    char *outfile = NULL;/* If set, where -u or -S write what they find */
+    int tune_jobs = 0;   /* If set, tune mm.c with this many processes (-S) */
+    double weight = UTIL_WEIGHT; /* Weight of util in the tuner's score */
+    int jobs = 1;        /* Traces evaluated at once, in child processes (-j) */
+    int quick = 0;       /* If set, freed requests this big skip merging (-q) */
+    char *policy = NULL; /* If set, the placement policy of mm.c (-P) */
+    char *gen_spec = NULL;/* If set, replay this synthetic workload (-G) */
+    int heap_mb;         /* Megabytes of simulated heap (-H) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,21 +428,22 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalsbzrLC:T:DXA:w:u:o:q:P:S:W:j:G:H:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
-        case 'f': /* Use one specific trace file only (relative to curr dir) */
-            num_tracefiles = 1;
-            if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
+        case 'f': /* Use specific trace files only (relative to curr dir) */
+            num_tracefiles++;
+            if ((tracefiles = realloc(tracefiles, 
+				      (num_tracefiles+1)*sizeof(char *))) == NULL)
 		unix_error("ERROR: realloc failed in main");
 	    strcpy(tracedir, "./"); 
-            tracefiles[0] = strdup(optarg);
-            tracefiles[1] = NULL;
+            tracefiles[num_tracefiles-1] = strdup(optarg);
+            tracefiles[num_tracefiles] = NULL;
             break;
 	case 't': /* Directory where the traces are located */
-	    if (num_tracefiles == 1) /* ignore if -f already encountered */
+	    if (num_tracefiles > 0) /* ignore if -f already encountered */
 		break;
 	    strcpy(tracedir, optarg);
 	    if (tracedir[strlen(tracedir)-1] != '/') 
@@ -184,6 +455,108 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 's': /* Use a single free list instead of size classes */
+            seglists = 0;
+            mm_setopt(MM_SEGLISTS, 0);
+            break;
+        case 'b': /* Replay runs of mallocs and frees in batches */
+            batch = 1;
+            break;
+        case 'z': /* Tell mm_free_sized the size of each freed block */
+            sized = 1;
+            break;
+        case 'r': /* Allocate from a region, which goes at the end */
+            use_region = 1;
+            break;
+        case 'L': /* Time each request and print latency histograms */
+            latency = 1;
+            break;
+        case 'C': /* Touch the payloads, walking them every n requests */
+            cache_walk = atoi(optarg);
+            if (cache_walk < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Replay each trace with up to this many threads */
+            threads = atoi(optarg);
+            if (threads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'D': /* Divide the ids of a trace among the threads */
+            divide_ids = 1;
+            break;
+        case 'X': /* Free each block in the next thread over */
+            cross_free = 1;
+            break;
+        case 'G': /* Replay a synthetic workload instead of the traces */
+            gen_spec = optarg;
+            break;
+        case 'H': /* Give the simulated heap this many megabytes */
+            heap_mb = atoi(optarg);
+            if (heap_mb < 1 || heap_mb > 4095) {
+                usage();
+                exit(1);
+            }
+            mem_set_max((size_t)heap_mb << 20);
+            break;
+        case 'w': /* Write the trace out in binary form, and stop */
+            binfile = optarg;
+            break;
+        case 'u': /* Sample the heap every n requests of each trace */
+            sample_every = atoi(optarg);
+            if (sample_every < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'o': /* File for the samples of -u or the result of -S */
+            outfile = optarg;
+            break;
+        case 'S': /* Search for the best settings of mm.c */
+            tune_jobs = atoi(optarg);
+            if (tune_jobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Evaluate this many traces at once */
+            jobs = atoi(optarg);
+            if (jobs < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'W': /* Weight of util against throughput for -S */
+            weight = atof(optarg);
+            if (weight < 0 || weight > 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Pick the fit, list order, split and growth of mm.c */
+            policy = optarg;
+            if (!set_policy(policy)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'q': /* Put off merging freed requests up to this size */
+            quick = atoi(optarg);
+            if (!mm_setopt(MM_QUICK, quick)) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'A': /* Arenas to use for the threaded replays */
+            thread_arenas = atoi(optarg);
+            if (thread_arenas < 1 || thread_arenas > MEM_MAX_ARENAS) {
+                usage();
+                exit(1);
+            }
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -225,6 +598,23 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /* Replay a synthetic workload, or write it out with -w, and stop */
+    if (gen_spec) {
+	gen_t gen;
+
+	if (!gen_parse(&gen, gen_spec)) {
+	    printf("%s: bad workload %s\n", argv[0], gen_spec);
+	    exit(1);
+	}
+	if (binfile)
+	    write_gen(&gen, binfile);
+	else {
+	    mem_init();
+	    eval_gen(&gen, gen_spec);
+	}
+	exit(errors ? 1 : 0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -235,9 +625,42 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* The samples of -u come in the order of the requests */
+    if (jobs > 1 && sample_every) {
+	printf("%s: -u takes the traces one at a time, not with -j\n", 
+	       argv[0]);
+	exit(1);
+    }
+
+    /* Convert a single trace to the binary format and exit */
+    if (binfile) {
+	if (num_tracefiles != 1) {
+	    printf("%s: -w needs a trace given with -f\n", argv[0]);
+	    exit(1);
+	}
+	trace = read_trace(tracedir, tracefiles[0]);
+	write_trace(trace, binfile);
+	free_trace(trace);
+	exit(0);
+    }
+
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Search the settings of mm.c on the traces, and stop */
+    if (tune_jobs) {
+	trace_t **traces = malloc(num_tracefiles * sizeof(trace_t *));
+
+	if (traces == NULL)
+	    unix_error("traces malloc in main failed");
+	for (i = 0; i < num_tracefiles; i++)
+	    traces[i] = read_trace(tracedir, tracefiles[i]);
+	mem_init();
+	tune(traces, num_tracefiles, tune_jobs, weight, 
+	     outfile ? outfile : "tuned.policy");
+	exit(0);
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -259,9 +682,12 @@ int main(int argc, char **argv)
 	    libc_stats[i].valid = eval_libc_valid(trace, i);
 	    if (libc_stats[i].valid) {
 		speed_params.trace = trace;
+		speed_params.lat = NULL;
+		speed_params.walk = 0;
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		spread = fsecs_spread(&libc_stats[i].median, &libc_stats[i].p99);
 	    }
 	    free_trace(trace);
 	}
@@ -286,26 +712,28 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    if (sample_every)
+	open_samples(outfile ? outfile : "timeline.csv");
+
+    if (verbose > 1) {
+	printf("Using %s%s%s", seglists ? "segregated free lists" : 
+	       "a single free list", batch ? ", in batches" : "",
+	       use_region ? ", one region per trace" : "");
+	if (quick)
+	    printf(", quick lists up to %d bytes", quick);
+	if (policy)
+	    printf(", policy %s", policy);
+	printf("\n");
+    }
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    if (jobs > 1)
+	eval_mm_parallel(tracefiles, num_tracefiles, jobs, mm_stats, threads);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &mm_stats[i], &ranges, threads);
+    if (sample_fp && fclose(sample_fp) != 0)
+	unix_error("Could not write the samples in main");
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -370,8 +798,145 @@ int main(int argc, char **argv)
  * The following routines manipulate the range list, which keeps 
  * track of the extent of every allocated block payload. We use the 
  * range list to detect any overlapping allocated blocks.
+ *
+ * The list is an AVL tree ordered by address, so each check is
+ * O(log n), and its records come from a pool instead of one libc
+ * malloc per block.
  ****************************************************************/
 
+#define HEIGHT(t) ((t) ? (t)->height : 0)
+
+/* new_range - take a record from the pool, refilling it from libc */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (free_ranges == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in add_range");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].right = free_ranges;
+	    free_ranges = &p[i];
+	}
+    }
+    p = free_ranges;
+    free_ranges = p->right;
+    return p;
+}
+
+/* put_range - give a record back to the pool */
+static void put_range(range_t *p)
+{
+    p->right = free_ranges;
+    free_ranges = p;
+}
+
+/* range_fix - recompute the height of t from its children */
+static void range_fix(range_t *t)
+{
+    int l = HEIGHT(t->left), r = HEIGHT(t->right);
+
+    t->height = (l > r ? l : r) + 1;
+}
+
+/* range_rotate - lift the left (dir 0) or right child of t above it */
+static range_t *range_rotate(range_t *t, int dir)
+{
+    range_t *c;
+
+    if (dir == 0) {
+	c = t->left;
+	t->left = c->right;
+	c->right = t;
+    } else {
+	c = t->right;
+	t->right = c->left;
+	c->left = t;
+    }
+    range_fix(t);
+    range_fix(c);
+    return c;
+}
+
+/* range_balance - restore the AVL property at t; returns the new root */
+static range_t *range_balance(range_t *t)
+{
+    int diff = HEIGHT(t->left) - HEIGHT(t->right);
+
+    if (diff > 1) {
+	if (HEIGHT(t->left->left) < HEIGHT(t->left->right))
+	    t->left = range_rotate(t->left, 1);
+	return range_rotate(t, 0);
+    }
+    if (diff < -1) {
+	if (HEIGHT(t->right->right) < HEIGHT(t->right->left))
+	    t->right = range_rotate(t->right, 0);
+	return range_rotate(t, 1);
+    }
+    range_fix(t);
+    return t;
+}
+
+/* range_insert - add record n to tree t; returns the new root */
+static range_t *range_insert(range_t *t, range_t *n)
+{
+    if (t == NULL) {
+	n->left = n->right = NULL;
+	n->height = 1;
+	return n;
+    }
+    if (n->lo < t->lo)
+	t->left = range_insert(t->left, n);
+    else
+	t->right = range_insert(t->right, n);
+    return range_balance(t);
+}
+
+/* 
+ * range_remove - unlink the record starting at lo from tree t, if
+ *     any, and return it in *found; returns the new root
+ */
+static range_t *range_remove(range_t *t, char *lo, range_t **found)
+{
+    range_t *m;
+
+    if (t == NULL)
+	return NULL;
+    if (lo < t->lo)
+	t->left = range_remove(t->left, lo, found);
+    else if (lo > t->lo)
+	t->right = range_remove(t->right, lo, found);
+    else {
+	*found = t;
+	if (t->left == NULL || t->right == NULL)
+	    return t->left ? t->left : t->right;
+	/* Put the lowest record of the right subtree in its place */
+	for (m = t->right; m->left != NULL; m = m->left)
+	    ;
+	t->right = range_remove(t->right, m->lo, &m);
+	m->left = t->left;
+	m->right = t->right;
+	t = m;
+    }
+    return range_balance(t);
+}
+
+/* range_below - the record with the highest lo at or below addr */
+static range_t *range_below(range_t *t, char *addr)
+{
+    range_t *best = NULL;
+
+    while (t != NULL) {
+	if (t->lo <= addr) {
+	    best = t;
+	    t = t->right;
+	} else
+	    t = t->left;
+    }
+    return best;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
@@ -395,36 +960,36 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or in a
+       region the allocator got from mem_map */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
+	 (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+	!mem_is_mapped(lo, size)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. Those are
+     * disjoint, so only the last one starting at or below hi can.
+     */
+    if ((p = range_below(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
      * by creating a range struct and adding it the range list.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -433,19 +998,11 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    range_t *p = NULL;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = range_remove(*ranges, lo, &p);
+    if (p != NULL)
+	put_range(p);
 }
 
 /*
@@ -453,13 +1010,13 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    put_range(p);
     *ranges = NULL;
 }
 
@@ -469,11 +1026,12 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace (see write_trace) is mapped rather than read.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
+    FILE *tracefile = NULL;  /* stays NULL for a binary trace */
     trace_t *trace;
     char type[MAXLINE];
     char path[MAXLINE];
@@ -487,23 +1045,26 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map_len = 0;
 	
     /* Read the trace file header */
     strcpy(path, tracedir);
     strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    if (!map_trace(trace, path)) {
+	if ((tracefile = fopen(path, "r")) == NULL) {
+	    sprintf(msg, "Could not open %s in read_trace", path);
+	    unix_error(msg);
+	}
+	fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+	fscanf(tracefile, "%d", &(trace->num_ids));     
+	fscanf(tracefile, "%d", &(trace->num_ops));     
+	fscanf(tracefile, "%d", &(trace->weight));        /* not used */
     
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
+	/* We'll store each request line in the trace in this array */
+	if ((trace->ops = 
+	     (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks = 
@@ -514,6 +1075,8 @@ static trace_t *read_trace(char *tracedir, char *filename)
     if ((trace->block_sizes = 
 	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
 	unix_error("malloc 4 failed in read_trace");
+    if (tracefile == NULL)
+	return trace;  /* the ops are already in place */
     
     /* read every request line in the trace file */
     index = 0;
@@ -538,6 +1101,7 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    fscanf(tracefile, "%ud", &index);
 	    trace->ops[op_index].type = FREE;
 	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = 0;
 	    break;
 	default:
 	    printf("Bogus type character (%c) in tracefile %s\n", 
@@ -554,13 +1118,99 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - if path is a binary trace, map it read-only and point
+ *     trace->ops into the mapping. Returns 0 if it is a text trace.
+ *     Every op's index is checked against num_ids once, as read_trace
+ *     does, so a corrupt file is rejected before the replay uses it.
+ */
+static int map_trace(trace_t *trace, char *path)
+{
+    bintrace_t hdr;
+    struct stat st;
+    traceop_t *op;
+    char *base;
+    int fd, i;
+
+    if ((fd = open(path, O_RDONLY)) < 0) 
+	return 0;    /* let fopen report it */
+    if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || 
+	memcmp(hdr.magic, BIN_MAGIC, sizeof(hdr.magic)) != 0) {
+	close(fd);
+	return 0;
+    }
+    if (hdr.op_size != sizeof(traceop_t) || fstat(fd, &st) < 0 ||
+	st.st_size != sizeof(hdr) + (off_t)hdr.num_ops * sizeof(traceop_t)) {
+	printf("Binary trace %s was written for another host or is truncated\n",
+	       path);
+	exit(1);
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    op = (traceop_t *)(base + sizeof(hdr));
+    for (i = 0; i < hdr.num_ops; i++) 
+	if (op[i].index < 0 || op[i].index >= hdr.num_ids ||
+	    (op[i].type != ALLOC && op[i].type != FREE && 
+	     op[i].type != REALLOC)) {
+	    printf("Binary trace %s has a bad op %d (type %d, index %d)\n",
+		   path, i, (int)op[i].type, op[i].index);
+	    exit(1);
+	}
+
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+    trace->ops = op;
+    trace->map_len = st.st_size;
+    return 1;
+}
+
+/*
+ * write_trace - write a trace in the binary format that read_trace
+ *     maps: a bintrace_t header and then the ops array as is.
+ */
+static void write_trace(trace_t *trace, char *path)
+{
+    FILE *fp;
+    bintrace_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BIN_MAGIC, sizeof(hdr.magic));
+    hdr.op_size = sizeof(traceop_t);
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace", path);
+	unix_error(msg);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, fp) != 
+	(size_t)trace->num_ops || fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s in write_trace", path);
+	unix_error(msg);
+    }
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map_len)       /* a binary trace is unmapped instead */
+	munmap((char *)trace->ops - sizeof(bintrace_t), trace->map_len);
+    else
+	free(trace->ops);     /* free the three arrays... */
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -571,6 +1221,166 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * eval_mm_trace - runs trace tracenum through the student's package:
+ *     checks it for correctness, then measures its space utilization
+ *     and throughput into *stats
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, stats_t *stats,
+			  range_t **ranges, int threads)
+{
+    trace_t *trace;
+    speed_t speed_params;
+    long avoided;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	avoided = mm_copies_avoided;  /* the next mm_init clears it */
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, ranges);
+	speed_params.trace = trace;
+	speed_params.ranges = *ranges;
+	speed_params.lat = NULL;
+	speed_params.walk = 0;
+	if (verbose > 1)
+	    printf("and performance.\n"
+		   "%ld reallocs were done without a copy.\n", avoided);
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	spread = fsecs_spread(&stats->median, &stats->p99);
+	if (verbose && have_stats)
+	    print_heapstats(tracenum);
+	if (latency)
+	    print_latency(&speed_params, tracenum);
+	if (cache_walk)
+	    print_cache(&speed_params, tracenum);
+	if (threads)
+	    print_scaling(trace, tracenum, threads);
+    }
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_parallel - eval_mm_trace for each of the n traces in a child
+ *     process of its own, up to jobs at once, each on a cpu no other
+ *     running child has while there are enough of them. Every child has
+ *     its own copy of the heap. The stats come back through a pipe, and
+ *     what a child prints goes to a temporary file, copied to stdout in
+ *     trace order once all are done.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, int jobs, 
+			     stats_t *stats, int threads)
+{
+    typedef struct {
+	stats_t stats;
+	int errors;
+	int spread;
+    } result_t;
+    cpu_set_t allowed, one;
+    int cpus[CPU_SETSIZE], ncpus = 0, *slot_of, *busy, *failed;
+    pid_t *pids, pid;
+    FILE **out;
+    int (*fds)[2];
+    result_t res;
+    range_t *ranges = NULL;
+    int i, j, c, status, running = 0;
+    char buf[MAXLINE];
+    size_t len;
+
+    /* the cpus we may run on, handed out to the children in turn */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+	for (c = 0; c < CPU_SETSIZE; c++)
+	    if (CPU_ISSET(c, &allowed))
+		cpus[ncpus++] = c;
+
+    pids = calloc(n, sizeof(pid_t));
+    fds = calloc(n, sizeof(*fds));
+    out = calloc(n, sizeof(FILE *));
+    slot_of = calloc(n, sizeof(int));
+    busy = calloc(jobs, sizeof(int));
+    failed = calloc(n, sizeof(int));
+    if (!pids || !fds || !out || !slot_of || !busy || !failed)
+	unix_error("calloc failed in eval_mm_parallel");
+
+    for (i = 0; i < n || running > 0; ) {
+	/* start the next trace in a free slot */
+	if (i < n && running < jobs) {
+	    for (j = 0; busy[j]; j++)
+		;
+	    busy[j] = 1;
+	    slot_of[i] = j;
+	    if ((out[i] = tmpfile()) == NULL || pipe(fds[i]) < 0)
+		unix_error("tmpfile or pipe failed in eval_mm_parallel");
+	    fflush(stdout);
+	    if ((pids[i] = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pids[i] == 0) {
+		close(fds[i][0]);
+		if (ncpus > 0) {
+		    CPU_ZERO(&one);
+		    CPU_SET(cpus[j % ncpus], &one);
+		    sched_setaffinity(0, sizeof(one), &one);
+		}
+		if (dup2(fileno(out[i]), STDOUT_FILENO) < 0)
+		    _exit(1);
+		memset(&res, 0, sizeof(res));
+		errors = 0;  /* the parent has counted its own already */
+		eval_mm_trace(tracefiles[i], i, &res.stats, &ranges, threads);
+		res.errors = errors;
+		res.spread = spread;
+		fflush(stdout);
+		_exit(write(fds[i][1], &res, sizeof(res)) != sizeof(res));
+	    }
+	    close(fds[i][1]);
+	    i++;
+	    running++;
+	    continue;
+	}
+
+	/* else wait for one to finish and take its stats */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in eval_mm_parallel");
+	for (j = 0; j < i && pids[j] != pid; j++)
+	    ;
+	if (j == i)
+	    continue;
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+	    read(fds[j][0], &res, sizeof(res)) == sizeof(res)) {
+	    stats[j] = res.stats;
+	    errors += res.errors;
+	    spread = res.spread;
+	}
+	else {
+	    failed[j] = 1;
+	    stats[j].valid = 0;
+	    errors++;
+	}
+	close(fds[j][0]);
+	busy[slot_of[j]] = 0;
+	running--;
+    }
+
+    /* what the children printed, in trace order */
+    for (i = 0; i < n; i++) {
+	rewind(out[i]);
+	while ((len = fread(buf, 1, sizeof(buf), out[i])) > 0)
+	    fwrite(buf, 1, len, stdout);
+	fclose(out[i]);
+	if (failed[i])
+	    printf("ERROR: the evaluation of trace %d did not finish\n", i);
+    }
+    free(pids);
+    free(fds);
+    free(out);
+    free(slot_of);
+    free(busy);
+    free(failed);
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -583,6 +1393,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *newp;
     char *oldp;
     char *p;
+    batch_t b;
+    mm_region_t *r = NULL;
     
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
@@ -593,8 +1405,13 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	malloc_error(tracenum, 0, "mm_init failed.");
 	return 0;
     }
+    if (use_region && (r = mm_region_create()) == NULL) {
+	malloc_error(tracenum, 0, "mm_region_create failed.");
+	return 0;
+    }
 
     /* Interpret each operation in the trace in order */
+    b.left = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
 	index = trace->ops[i].index;
 	size = trace->ops[i].size;
@@ -604,7 +1421,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
 	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+	    if (r)
+		p = mm_region_alloc(r, size);
+	    else
+		p = batch ? batch_malloc(&b, trace, i) : mm_malloc(size);
+	    if (p == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -633,7 +1454,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* Call the student's realloc */
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+	    if (r)
+		newp = region_realloc(r, oldp, trace->block_sizes[index], size);
+	    else
+		newp = mm_realloc(oldp, size);
+	    if (newp == NULL) {
 		malloc_error(tracenum, i, "mm_realloc failed.");
 		return 0;
 	    }
@@ -653,7 +1478,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -671,7 +1496,14 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remove region from list and call student's free function */
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
-	    mm_free(p);
+	    if (r)
+		break;  /* region objects only go with the region */
+	    if (batch)
+		batch_free(&b, trace, i);
+	    else if (sized)
+		mm_free_sized(p, trace->block_sizes[index]);
+	    else
+		mm_free(p);
 	    break;
 
 	default:
@@ -680,6 +1512,9 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 
     }
 
+    if (r)
+	mm_region_destroy(r);
+
     /* As far as we know, this is a valid malloc package */
     return 1;
 }
@@ -689,10 +1524,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for 
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
- *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   most bytes the heap held at any point of the trace, from 
+ *   mem_heap_peak(). The allocator may give memory back with a 
+ *   negative mem_sbrk() or by unmapping a region, so the heap's size
+ *   at the end of the trace can be below its peak. 
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -702,22 +1537,34 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    int stats_size = 0;  /* payload when peak_stats was last taken */
     char *p;
     char *newp, *oldp;
+    batch_t b;
+    mm_region_t *r = NULL;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
+    if (use_region && (r = mm_region_create()) == NULL)
+	app_error("mm_region_create failed in eval_mm_util");
 
+    b.left = 0;
     for (i = 0;  i < trace->num_ops;  i++) {
+	if (sample_fp && i % sample_every == 0)
+	    sample_heap(tracenum, i, total_size);
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    if (r)
+		p = mm_region_alloc(r, size);
+	    else
+		p = batch ? batch_malloc(&b, trace, i) : mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -728,7 +1575,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	     * of all allocated blocks */
 	    total_size += size;
 	    
-	    /* Update statistics */
+	    /* Update statistics, with the heap's shape near the peak */
+	    if (verbose && total_size > stats_size + stats_size / STATS_STEP) {
+		have_stats = mm_stats(&peak_stats);
+		stats_size = total_size;
+	    }
 	    max_total_size = (total_size > max_total_size) ?
 		total_size : max_total_size;
 	    break;
@@ -739,7 +1590,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
+	    if (r)
+		newp = region_realloc(r, oldp, oldsize, newsize);
+	    else
+		newp = mm_realloc(oldp,newsize);
+	    if (newp == NULL)
 		app_error("mm_realloc failed in eval_mm_util");
 
 	    /* Remember region and size */
@@ -750,7 +1605,11 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	     * of all allocated blocks */
 	    total_size += (newsize - oldsize);
 	    
-	    /* Update statistics */
+	    /* Update statistics, with the heap's shape near the peak */
+	    if (verbose && total_size > stats_size + stats_size / STATS_STEP) {
+		have_stats = mm_stats(&peak_stats);
+		stats_size = total_size;
+	    }
 	    max_total_size = (total_size > max_total_size) ?
 		total_size : max_total_size;
 	    break;
@@ -760,7 +1619,14 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
-	    mm_free(p);
+	    if (r)
+		;   /* region objects only go with the region */
+	    else if (batch)
+		batch_free(&b, trace, i);
+	    else if (sized)
+		mm_free_sized(p, size);
+	    else
+		mm_free(p);
 	    
 	    /* Keep track of current total size
 	     * of all allocated blocks */
@@ -774,7 +1640,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    if (sample_fp)
+	sample_heap(tracenum, i, total_size);
+    if (verbose && have_stats)
+	mm_stats(&end_stats);
+    if (r)
+	mm_region_destroy(r);
+
+    /* The allocator may have trimmed the heap; charge it for the peak */
+    return ((double)max_total_size / (double)mem_heap_peak());
 }
 
 
@@ -787,42 +1661,694 @@ static void eval_mm_speed(void *ptr)
     int i, index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    lathist_t *lat = ((speed_t *)ptr)->lat;
+    int walk = ((speed_t *)ptr)->walk;
+    unsigned long long t0 = 0;
+    batch_t b;
+    mm_region_t *r = NULL;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
+    if (use_region && (r = mm_region_create()) == NULL)
+	app_error("mm_region_create failed in eval_mm_speed");
+    if (walk)   /* no block is live yet */
+	memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
 
     /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
+    b.left = 0;
+    for (i = 0;  i < trace->num_ops;  i++) {
+        if (lat)
+	    t0 = read_ticks();
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if (r)
+		p = mm_region_alloc(r, size);
+            else
+		p = batch ? batch_malloc(&b, trace, i) : mm_malloc(size);
+            if (p == NULL)
 		app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
+            if (sized || r)
+		trace->block_sizes[index] = size;
             break;
 
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
 	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+            if (r)
+		newp = region_realloc(r, oldp, trace->block_sizes[index], newsize);
+            else
+		newp = mm_realloc(oldp,newsize);
+            if (newp == NULL)
 		app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
+            if (sized || r)
+		trace->block_sizes[index] = newsize;
             break;
 
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            if (r)
+		break;  /* region objects only go with the region */
+            if (batch)
+		batch_free(&b, trace, i);
+            else if (sized)
+		mm_free_sized(block, trace->block_sizes[index]);
+            else
+		mm_free(block);
             break;
 
 	default:
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
+        if (lat)
+	    lat_add(&lat[trace->ops[i].type], read_ticks() - t0, i);
+        if (walk)
+	    touch_op(trace, i, walk, b.left);
+    }
+
+    /* The whole region goes at once, as part of the timed run */
+    if (r)
+	mm_region_destroy(r);
+}
+
+/*
+ * lat_add - count a request of op number op that took ticks
+ */
+static void lat_add(lathist_t *h, unsigned long long ticks, int op)
+{
+    int e, j;
+
+    if (ticks < LAT_SUB)
+	h->count[ticks]++;
+    else {
+	e = 63 - __builtin_clzll(ticks);   /* ticks lies in [2^e, 2^(e+1)) */
+	h->count[(e - LAT_SUB_BITS + 1) * LAT_SUB + 
+		 (int)(ticks >> (e - LAT_SUB_BITS)) - LAT_SUB]++;
+    }
+    h->n++;
+    if (ticks > h->max)
+	h->max = ticks;
+
+    /* Keep the slowest few, in order */
+    if (ticks <= h->worst[LAT_WORST-1])
+	return;
+    for (j = LAT_WORST-1; j > 0 && h->worst[j-1] < ticks; j--) {
+	h->worst[j] = h->worst[j-1];
+	h->worst_op[j] = h->worst_op[j-1];
+    }
+    h->worst[j] = ticks;
+    h->worst_op[j] = op;
+}
+
+/*
+ * lat_quantile - the top of the bucket that holds the q quantile, or
+ *     the maximum if that is lower
+ */
+static unsigned long long lat_quantile(lathist_t *h, double q)
+{
+    unsigned long seen = 0, want = (unsigned long)(q * h->n);
+    unsigned long long top;
+    int j, g;
+
+    for (j = 0; j < LAT_BUCKETS - 1; j++) {
+	seen += h->count[j];
+	if (seen > want)
+	    break;
+    }
+    if (j < LAT_SUB)
+	return j;
+    g = j / LAT_SUB;
+    top = ((unsigned long long)(LAT_SUB + j % LAT_SUB + 1) << (g - 1)) - 1;
+    return top < h->max ? top : h->max;
+}
+
+/*
+ * lat_ns - ticks in nanoseconds, less the overhead of reading the counter
+ */
+static double lat_ns(unsigned long long ticks, unsigned long long ovhd)
+{
+    return ticks > ovhd ? (ticks - ovhd) / ticks_per_nsec() : 0.0;
+}
+
+/*
+ * print_latency - replay the trace once more, timing every request,
+ *     and print the percentiles and slowest requests of each type.
+ *     The cost of reading the counter itself is taken off.
+ */
+static void print_latency(speed_t *params, int tracenum)
+{
+    static char *names[] = {"malloc", "free", "realloc"};
+    lathist_t hist[3];
+    unsigned long long ovhd = ticks_ovhd();
+    lathist_t *h;
+    int t, j;
+
+    memset(hist, 0, sizeof(hist));
+    params->lat = hist;
+    eval_mm_speed(params);
+    params->lat = NULL;
+
+    printf("\nLatency of trace %d in ns (%.0f ns of timer overhead taken off):\n",
+	   tracenum, lat_ns(2 * ovhd, ovhd));
+    printf("%-8s%9s%8s%8s%8s%9s  %s\n", "request", "count", "p50", "p99",
+	   "p99.9", "max", "slowest (request number)");
+    for (t = 0; t < 3; t++) {
+	h = &hist[t];
+	if (h->n == 0)
+	    continue;
+	printf("%-8s%9lu%8.0f%8.0f%8.0f%9.0f ", names[t], h->n,
+	       lat_ns(lat_quantile(h, 0.5), ovhd), 
+	       lat_ns(lat_quantile(h, 0.99), ovhd),
+	       lat_ns(lat_quantile(h, 0.999), ovhd), lat_ns(h->max, ovhd));
+	for (j = 0; j < LAT_WORST && j < (int)h->n; j++)
+	    printf(" %.0f (%d)", lat_ns(h->worst[j], ovhd), h->worst_op[j]);
+	printf("\n");
+    }
+}
+
+/*
+ * touch_op - use the payload of request i the way a program would: write
+ *     all of a new block, forget a freed one, and every walk requests
+ *     read a byte of each cache line of every live block. With -b, the
+ *     blocks of the next freed requests of the run went with this one.
+ */
+static void touch_op(trace_t *trace, int i, int walk, int freed)
+{
+    int index = trace->ops[i].index;
+    size_t j;
+    char sum = 0;
+
+    if (trace->ops[i].type == FREE) {
+	for (j = 0; j <= (size_t)freed; j++)
+	    trace->block_sizes[trace->ops[i + j].index] = 0;
+    }
+    else {
+	trace->block_sizes[index] = trace->ops[i].size;
+	memset(trace->blocks[index], index, trace->ops[i].size);
+    }
+    if ((i + 1) % walk)
+	return;
+    for (index = 0; index < trace->num_ids; index++)
+	for (j = 0; j < trace->block_sizes[index]; j += CACHE_LINE)
+	    sum += trace->blocks[index][j];
+    cache_sink = sum;
+}
+
+/*
+ * print_cache - replay the trace under the hardware counters twice, as
+ *     is and with touch_op after each request, and print the cycles and
+ *     misses per request of both. The difference is what the layout of
+ *     the heap costs the program beyond the calls themselves.
+ */
+static void print_cache(speed_t *params, int tracenum)
+{
+    static char *names[] = {"calls", "touched"};
+    static char *events[] = {"cycles", "LLC misses", "dTLB misses"};
+    long long counts[PMC_EVENTS];
+    unsigned long long t0 = 0, ticks;
+    double ops = params->trace->num_ops;
+    int run, e;
+
+    printf("\nCache behavior of trace %d, live set read every %d "
+	   "requests, per request:\n%-8s", tracenum, cache_walk, "run");
+    for (e = 0; e < PMC_EVENTS; e++)
+	printf("%13s", events[e]);
+    printf("\n");
+    for (run = 0; run < 2; run++) {
+	params->walk = run ? cache_walk : 0;
+	t0 = read_ticks();
+	pmc_start();
+	eval_mm_speed(params);
+	pmc_stop(counts);
+	ticks = read_ticks() - t0;
+	params->walk = 0;
+
+	/* Without a cycle counter, the time stamp counter will do */
+	if (counts[0] < 0)
+	    counts[0] = ticks;
+	printf("%-8s", names[run]);
+	for (e = 0; e < PMC_EVENTS; e++)
+	    if (counts[e] < 0)
+		printf("%13s", "-");
+	    else
+		printf("%13.*f", e ? 3 : 1, counts[e] / ops);
+	printf("\n");
+    }
+}
+
+/*
+ * print_heapstats - print what mm_stats saw at the trace's payload
+ *     peak during the utilization run, to within 1/STATS_STEP of it,
+ *     and the work counted over the whole run. The free blocks per size
+ *     class need -V.
+ */
+static void print_heapstats(int tracenum)
+{
+    mm_stats_t *p = &peak_stats, *e = &end_stats;
+    long blocks = 0;
+    int c;
+
+    for (c = 0; c < MM_STAT_CLASSES; c++)
+	blocks += p->free_blocks[c];
+    printf("Heap of trace %d at its peak: %lu live, %lu free in %ld blocks, "
+	   "largest %lu, fragmentation %.2f\n", tracenum, 
+	   (unsigned long)p->live_bytes, (unsigned long)p->free_bytes, blocks,
+	   (unsigned long)p->largest_free, p->fragmentation);
+    printf("  %ld sbrks, %ld splits, %ld merges, %.2f blocks looked at "
+	   "per fit\n", e->sbrks, e->splits, e->merges, 
+	   e->fits ? (double)e->fit_steps / e->fits : 0.0);
+    if (e->quick_hits || e->quick_flushes)
+	printf("  %ld requests from quick lists, %ld merges of the lists\n",
+	       e->quick_hits, e->quick_flushes);
+    if (verbose > 1) {
+	printf("  free blocks by class:");
+	for (c = 0; c < MM_STAT_CLASSES; c++)
+	    if (p->free_blocks[c])
+		printf(" %d:%ld", c, p->free_blocks[c]);
+	printf("\n");
+    }
+}
+
+/*
+ * open_samples - open the timeline of -u; a path ending in .bin gets
+ *     the samples in binary, any other one a CSV file
+ */
+static void open_samples(char *path)
+{
+    size_t len = strlen(path);
+
+    sample_bin = len > 4 && !strcmp(path + len - 4, ".bin");
+    if ((sample_fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in open_samples", path);
+	unix_error(msg);
+    }
+    if (sample_bin)
+	fwrite(SAMPLE_MAGIC, 1, strlen(SAMPLE_MAGIC), sample_fp);
+    else
+	fprintf(sample_fp, "trace,op,live,heap,free_blocks,largest_free\n");
+}
+
+/*
+ * sample_heap - add a sample to the timeline: the heap after the first
+ *     op requests of trace tracenum, with live payload bytes in use
+ */
+static void sample_heap(int tracenum, int op, int live)
+{
+    sample_t s;
+    mm_stats_t st;
+    int c;
+
+    s.trace = tracenum;
+    s.op = op;
+    s.live = live;
+    s.heap = mem_heapsize();
+    s.free_blocks = s.largest_free = -1;
+    if (mm_stats(&st)) {
+	for (s.free_blocks = 0, c = 0; c < MM_STAT_CLASSES; c++)
+	    s.free_blocks += st.free_blocks[c];
+	s.largest_free = st.largest_free;
+    }
+
+    if (sample_bin)
+	fwrite(&s, sizeof(s), 1, sample_fp);
+    else
+	fprintf(sample_fp, "%d,%d,%ld,%ld,%ld,%ld\n", s.trace, s.op, 
+		s.live, s.heap, s.free_blocks, s.largest_free);
+}
+
+/*
+ * region_realloc - realloc for a region object: a new object gets a
+ *    copy of the old one, which stays until the region goes
+ */
+static char *region_realloc(mm_region_t *r, char *oldp, int oldsize, 
+			    int size)
+{
+    char *newp;
+
+    if ((newp = mm_region_alloc(r, size)) != NULL)
+	memcpy(newp, oldp, oldsize < size ? oldsize : size);
+    return newp;
+}
+
+/*
+ * batch_run - the number of requests from request i on that can go to
+ *    the batch API together: consecutive mallocs of one size, or
+ *    consecutive frees, BATCH_MAX at most. Reallocs go alone.
+ */
+static int batch_run(trace_t *trace, int i)
+{
+    traceop_t *op = &trace->ops[i];
+    int n = 1;
+
+    if (op->type == REALLOC)
+	return 1;
+    while (i + n < trace->num_ops && n < BATCH_MAX && 
+	   op[n].type == op->type && 
+	   (op->type == FREE || op[n].size == op->size))
+	n++;
+    return n;
+}
+
+/*
+ * batch_malloc - the block for malloc request i. The first request of
+ *    a run allocates the blocks of the whole run with mm_malloc_batch;
+ *    the rest of the run takes them in turn. Returns NULL if the
+ *    allocator could not supply the run.
+ */
+static char *batch_malloc(batch_t *b, trace_t *trace, int i)
+{
+    int n;
+
+    if (b->left == 0) {
+	if ((n = batch_run(trace, i)) == 1)
+	    return mm_malloc(trace->ops[i].size);
+	if (mm_malloc_batch(trace->ops[i].size, n, (void **)b->ptrs) < n)
+	    return NULL;
+	b->next = 0;
+	b->left = n;
+    }
+    b->left--;
+    return b->ptrs[b->next++];
+}
+
+/*
+ * batch_free - replay free request i. The first request of a run frees
+ *    the blocks of the whole run with mm_free_batch; for the rest of
+ *    the run there is nothing left to do.
+ */
+static void batch_free(batch_t *b, trace_t *trace, int i)
+{
+    int k, n;
+
+    if (b->left == 0) {
+	if ((n = batch_run(trace, i)) == 1) {
+	    k = trace->ops[i].index;
+	    if (sized)
+		mm_free_sized(trace->blocks[k], trace->block_sizes[k]);
+	    else
+		mm_free(trace->blocks[k]);
+	    return;
+	}
+	for (k = 0; k < n; k++)
+	    b->ptrs[k] = trace->blocks[trace->ops[i + k].index];
+	mm_free_batch((void **)b->ptrs, n);
+	b->left = n;
+    }
+    b->left--;
+}
+
+/*
+ * wall_secs - Monotonic wall-clock time in seconds. The threaded
+ *    replays are timed with this rather than fcyc, which only
+ *    measures the calling thread.
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * mailbox_put - Hand block to the next thread over, which will free it
+ *    the next time it drains its mailbox. A full mailbox makes the
+ *    sender wait, draining its own mailbox meanwhile so that a ring of
+ *    waiting threads still makes progress; otherwise a thread that
+ *    runs ahead would pile up its whole trace's worth of garbage.
+ */
+static void mailbox_put(thread_t *t, char *block)
+{
+    mailbox_t *box = &mailboxes[(t->id + 1) % t->nthreads];
+
+    pthread_mutex_lock(&box->lock);
+    while (box->count >= MAILBOX_MAX && !box->closed) {
+	pthread_mutex_unlock(&box->lock);
+	mailbox_drain(&mailboxes[t->id]);
+	sched_yield();
+	pthread_mutex_lock(&box->lock);
+    }
+    if (box->count == box->max) {
+	box->max = box->max ? 2 * box->max : 256;
+	if ((box->blocks = realloc(box->blocks, 
+				   box->max * sizeof(char *))) == NULL)
+	    unix_error("realloc failed in mailbox_put");
+    }
+    box->blocks[box->count++] = block;
+    pthread_mutex_unlock(&box->lock);
+}
+
+/*
+ * mailbox_drain - Free every block waiting in box. Only the thread
+ *    that owns box calls this, so the lock is never held across mm_free.
+ */
+static void mailbox_drain(mailbox_t *box)
+{
+    char *batch[DRAIN_EVERY];
+    int i, n;
+
+    do {
+	pthread_mutex_lock(&box->lock);
+	n = box->count < DRAIN_EVERY ? box->count : DRAIN_EVERY;
+	box->count -= n;
+	memcpy(batch, box->blocks + box->count, n * sizeof(char *));
+	pthread_mutex_unlock(&box->lock);
+	for (i = 0; i < n; i++)
+	    mm_free(batch[i]);
+    } while (n == DRAIN_EVERY);
+}
+
+/*
+ * replay_thread - Body of one replay thread. Every thread walks the
+ *    whole trace; with -D it only issues the requests for the ids it
+ *    owns (id % nthreads), otherwise it issues all of them against
+ *    its own blocks array. The first and last payload bytes of each
+ *    block are stamped with a per-thread tag and checked before the
+ *    block is reallocated or freed, which catches allocators that hand
+ *    the same memory to two threads.
+ */
+static void *replay_thread(void *ptr)
+{
+    thread_t *t = (thread_t *)ptr;
+    trace_t *trace = t->trace;
+    int i, index, size;
+    char *p, tag;
+
+    pthread_barrier_wait(&thread_start);
+    t->start = wall_secs();
+
+    for (i = 0;  i < trace->num_ops && !t->failed;  i++) {
+	index = trace->ops[i].index;
+	if (divide_ids && index % t->nthreads != t->id)
+	    continue;
+	size = trace->ops[i].size;
+	tag = (char)(index * 31 + t->id);
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(size)) == NULL) {
+		t->failed = 1;
+		break;
+	    }
+	    p[0] = p[size-1] = tag;
+	    t->blocks[index] = p;
+	    t->block_sizes[index] = size;
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    p = t->blocks[index];
+	    if (p[0] != tag || p[t->block_sizes[index]-1] != tag) {
+		t->failed = 2;
+		break;
+	    }
+	    if ((p = mm_realloc(p, size)) == NULL) {
+		t->failed = 1;
+		break;
+	    }
+	    if (p[0] != tag) {
+		t->failed = 2;
+		break;
+	    }
+	    p[size-1] = tag;
+	    t->blocks[index] = p;
+	    t->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* mm_free */
+	    p = t->blocks[index];
+	    if (p[0] != tag || p[t->block_sizes[index]-1] != tag) {
+		t->failed = 2;
+		break;
+	    }
+	    if (cross_free)
+		mailbox_put(t, p);
+	    else if (sized)
+		mm_free_sized(p, t->block_sizes[index]);
+	    else
+		mm_free(p);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+	}
+	t->ops++;
+
+	if (cross_free && t->ops % DRAIN_EVERY == 0)
+	    mailbox_drain(&mailboxes[t->id]);
+    }
+
+    /* Nothing more can arrive once every thread is past the barrier */
+    if (cross_free) {
+	pthread_mutex_lock(&mailboxes[t->id].lock);
+	mailboxes[t->id].closed = 1;
+	pthread_mutex_unlock(&mailboxes[t->id].lock);
+	pthread_barrier_wait(&thread_done);
+	mailbox_drain(&mailboxes[t->id]);
+    }
+
+    t->end = wall_secs();
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay trace with nthreads threads on a fresh
+ *    heap and return the aggregate throughput in Kops, the best of
+ *    THREAD_RUNS runs. The per-thread throughputs of that run are
+ *    stored in thread_kops. Returns -1 if the heap ran out and -2 if
+ *    a payload was corrupted.
+ */
+static double eval_mm_threads(trace_t *trace, int nthreads, 
+			      double *thread_kops)
+{
+    thread_t *threads;
+    double start, end, kops, best = 0;
+    int i, run, ops, failed = 0;
+
+    if ((threads = calloc(nthreads, sizeof(thread_t))) == NULL)
+	unix_error("calloc failed in eval_mm_threads");
+    if (cross_free && (mailboxes = calloc(nthreads, sizeof(mailbox_t))) == NULL)
+	unix_error("calloc failed in eval_mm_threads");
+    for (i = 0; i < nthreads; i++) {
+	threads[i].trace = trace;
+	threads[i].id = i;
+	threads[i].nthreads = nthreads;
+	threads[i].blocks = calloc(trace->num_ids, sizeof(char *));
+	threads[i].block_sizes = calloc(trace->num_ids, sizeof(int));
+	if (threads[i].blocks == NULL || threads[i].block_sizes == NULL)
+	    unix_error("calloc failed in eval_mm_threads");
+	if (cross_free)
+	    pthread_mutex_init(&mailboxes[i].lock, NULL);
+    }
+    pthread_barrier_init(&thread_start, NULL, nthreads);
+    pthread_barrier_init(&thread_done, NULL, nthreads);
+
+    for (run = 0; run < THREAD_RUNS && !failed; run++) {
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	mm_setopt(MM_ARENAS, thread_arenas);
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_threads");
+	mm_setopt(MM_ARENAS, 1);
+
+	for (i = 0; i < nthreads; i++) {
+	    threads[i].ops = 0;
+	    threads[i].failed = 0;
+	    if (cross_free)
+		mailboxes[i].closed = 0;
+	    if (pthread_create(&threads[i].tid, NULL, replay_thread, 
+			       &threads[i]) != 0)
+		unix_error("pthread_create failed in eval_mm_threads");
+	}
+
+	/* The run lasts from the first thread's start to the last one's end */
+	ops = 0;
+	start = DBL_MAX;
+	end = 0;
+	for (i = 0; i < nthreads; i++) {
+	    pthread_join(threads[i].tid, NULL);
+	    ops += threads[i].ops;
+	    start = threads[i].start < start ? threads[i].start : start;
+	    end = threads[i].end > end ? threads[i].end : end;
+	    if (threads[i].failed > failed)
+		failed = threads[i].failed;
+	}
+
+	kops = ops / 1e3 / (end - start);
+	if (!failed && kops > best) {
+	    best = kops;
+	    for (i = 0; i < nthreads; i++)
+		thread_kops[i] = threads[i].ops / 1e3 / 
+		    (threads[i].end - threads[i].start);
+	}
+    }
+
+    pthread_barrier_destroy(&thread_start);
+    pthread_barrier_destroy(&thread_done);
+    for (i = 0; i < nthreads; i++) {
+	free(threads[i].blocks);
+	free(threads[i].block_sizes);
+	if (cross_free) {
+	    pthread_mutex_destroy(&mailboxes[i].lock);
+	    free(mailboxes[i].blocks);
+	}
+    }
+    free(threads);
+    free(mailboxes);
+    mailboxes = NULL;
+
+    return failed ? -failed : best;
+}
+
+/*
+ * print_scaling - Replay trace with 1, 2, 4, ... and finally 
+ *    max_threads threads and print how the throughput scales against
+ *    the single-threaded run. A corrupted payload counts as an error.
+ */
+static void print_scaling(trace_t *trace, int tracenum, int max_threads)
+{
+    double kops, base = 0, *thread_kops;
+    int i, n;
+
+    if ((thread_kops = calloc(max_threads, sizeof(double))) == NULL)
+	unix_error("calloc failed in print_scaling");
+
+    printf("\nTrace %d with up to %d threads, %s ids, %s frees, %d arena%s:\n",
+	   tracenum, max_threads, divide_ids ? "divided" : "replicated",
+	   cross_free ? "cross-thread" : "local", thread_arenas,
+	   thread_arenas > 1 ? "s" : "");
+    printf("%7s %10s %8s  %s\n", "threads", "Kops", "speedup", 
+	   "per-thread Kops");
+
+    for (n = 1; n <= max_threads; n = (n < max_threads && 2*n > max_threads)
+	     ? max_threads : 2*n) {
+	kops = eval_mm_threads(trace, n, thread_kops);
+	if (kops < 0) {
+	    printf("%7d %10s\n", n, kops == -1 ? "no memory" : "corrupted");
+	    if (kops == -2) {
+		errors++;
+		printf("ERROR [trace %d]: payload overwritten with %d threads\n",
+		       tracenum, n);
+	    }
+	    break;
+	}
+	if (n == 1)
+	    base = kops;
+	printf("%7d %10.0f %7.2fx ", n, kops, kops / base);
+	for (i = 0; i < n; i++)
+	    printf(" %.0f", thread_kops[i]);
+	printf("\n");
+    }
+
+    free(thread_kops);
 }
 
 /*
@@ -915,6 +2441,651 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+/*
+ * tune - searches the settings in knobs[] for the policy with the best
+ *     score on the n traces, one setting at a time: every other value
+ *     of a setting is scored with the rest held, jobs at once, and the
+ *     best one is kept if it beats the current policy. Passes over the
+ *     settings repeat until one changes nothing, TUNE_ROUNDS at most.
+ *     The policy found goes to path, in the form -P takes.
+ */
+static void tune(trace_t **traces, int n, int jobs, double weight, 
+		 char *path)
+{
+    static char policies[TUNE_VALUES][MAXLINE];
+    double scores[TUNE_VALUES], best;
+    int cur[NUM_KNOBS], vals[TUNE_VALUES];
+    int k, v, m, j, round, changed = 1;
+    char policy[MAXLINE];
+    FILE *fp;
+
+    memset(cur, 0, sizeof(cur));
+    tune_policy(cur, policies[0]);
+    tune_scores(policies, 1, scores, traces, n, jobs, weight);
+    best = scores[0];
+    printf("Tuning %d traces, util weight %.2f, %d at a time\n", n, weight,
+	   jobs);
+    printf("%6.1f  %s\n", best, policies[0]);
+
+    for (round = 0; round < TUNE_ROUNDS && changed; round++) {
+	changed = 0;
+	for (k = 0; k < NUM_KNOBS; k++) {
+	    /* the policy with each other value of setting k */
+	    m = 0;
+	    for (v = 0; knobs[k].values[v] != NULL; v++) {
+		if (v == cur[k])
+		    continue;
+		j = cur[k];
+		cur[k] = v;
+		tune_policy(cur, policies[m]);
+		cur[k] = j;
+		vals[m++] = v;
+	    }
+	    tune_scores(policies, m, scores, traces, n, jobs, weight);
+
+	    for (j = 0; j < m; j++) {
+		if (verbose)
+		    printf("        %-12s %6.1f\n", knobs[k].values[vals[j]],
+			   scores[j]);
+		if (scores[j] > best) {
+		    best = scores[j];
+		    cur[k] = vals[j];
+		    changed = 1;
+		}
+	    }
+	    tune_policy(cur, policy);
+	    if (changed && verbose)
+		printf("%6.1f  %s\n", best, policy);
+	}
+	printf("%6.1f  %s (pass %d)\n", best, policy, round + 1);
+    }
+
+    if ((fp = fopen(path, "w")) == NULL || 
+	fprintf(fp, "%s\n", policy) < 0 || fclose(fp) != 0) {
+	sprintf(msg, "Could not write %s in tune", path);
+	unix_error(msg);
+    }
+    printf("Best policy, in %s: %s\n", path, policy);
+}
+
+/*
+ * tune_scores - scores the n policies, each in a child process of its
+ *     own with up to jobs of them running; a policy whose child fails
+ *     scores -1. The children share the cpus, so throughput is
+ *     measured best with -S 1.
+ */
+static void tune_scores(char (*policies)[MAXLINE], int n, double *scores,
+			trace_t **traces, int ntraces, int jobs, 
+			double weight)
+{
+    pid_t pids[TUNE_VALUES], pid;
+    int fds[TUNE_VALUES][2];
+    int i, j, status, running = 0;
+    double score;
+
+    fflush(stdout);
+    for (i = 0; i < n || running > 0; ) {
+	/* start a child whenever there is room */
+	if (i < n && running < jobs) {
+	    if (pipe(fds[i]) < 0)
+		unix_error("pipe failed in tune_scores");
+	    if ((pids[i] = fork()) < 0)
+		unix_error("fork failed in tune_scores");
+	    if (pids[i] == 0) {
+		close(fds[i][0]);
+		score = tune_score(policies[i], traces, ntraces, weight);
+		fflush(stdout);
+		_exit(write(fds[i][1], &score, sizeof(score)) != sizeof(score));
+	    }
+	    close(fds[i][1]);
+	    i++;
+	    running++;
+	    continue;
+	}
+
+	/* else collect one that is done */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in tune_scores");
+	for (j = 0; j < i && pids[j] != pid; j++)
+	    ;
+	if (j == i)
+	    continue;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+	    read(fds[j][0], &scores[j], sizeof(double)) != sizeof(double))
+	    scores[j] = -1;
+	close(fds[j][0]);
+	running--;
+    }
+}
+
+/*
+ * tune_score - the perfindex of mm.c under policy on the n traces, with
+ *     util weighted by weight; 0 if any trace fails
+ */
+static double tune_score(char *policy, trace_t **traces, int n, 
+			 double weight)
+{
+    range_t *ranges = NULL;
+    speed_t params;
+    double secs = 0, ops = 0, util = 0, thru;
+    int i;
+
+    if (!set_policy(policy))
+	return 0;
+    for (i = 0; i < n; i++) {
+	if (!eval_mm_valid(traces[i], i, &ranges))
+	    return 0;
+	util += eval_mm_util(traces[i], i, &ranges);
+	params.trace = traces[i];
+	params.ranges = ranges;
+	params.lat = NULL;
+	params.walk = 0;
+	secs += fsecs(eval_mm_speed, &params);
+	ops += traces[i]->num_ops;
+    }
+
+    thru = ops / secs;
+    return 100 * (weight * util / n + (1 - weight) * 
+		  (thru > AVG_LIBC_THRUPUT ? 1 : thru / AVG_LIBC_THRUPUT));
+}
+
+/* tune_policy - writes the policy for the knob values in cur */
+static void tune_policy(int *cur, char *policy)
+{
+    int k;
+
+    policy[0] = '\0';
+    for (k = 0; k < NUM_KNOBS; k++) {
+	if (k > 0)
+	    strcat(policy, ",");
+	strcat(policy, knobs[k].values[cur[k]]);
+    }
+}
+
+/*
+ * gen_parse - sets up g for the workload spec, comma-separated settings
+ *     such as "ops=1e9,live=1e5,size=pow:1.5:16:4096,realloc=0.05:2":
+ *       ops=<n>      requests before the blocks still live are freed
+ *       live=<n>     mean lifetime, in mallocs, and so the live blocks
+ *       life=exp, life=const or life=pow:<shape>, the lifetime's law
+ *       size=uniform:<lo>:<hi>, size=pow:<a>:<lo>:<hi> (a power law of
+ *                    exponent a), size=bimodal:<s1>:<s2>:<p of s1>,
+ *                    size=hist:<file> of "<size> <weight>" lines, or
+ *                    size=trace:<file> for the sizes a trace asks for
+ *       realloc=<p>[:<factor>] a request reallocs a live block with
+ *                    chance p, scaling it by factor (1.5), up to max=
+ *       max=<bytes>, seed=<n>, rows=<n> lines of report
+ *     Returns 0 at a setting it does not know or a value out of range.
+ */
+static int gen_parse(gen_t *g, char *spec)
+{
+    char buf[MAXLINE], *tok, *v;
+    sizedist_t *d = &g->size;
+    int ok;
+
+    memset(g, 0, sizeof(*g));
+    g->ops = 1000000;
+    g->live = 1000;
+    g->life = LIFE_EXP;
+    g->growth = 1.5;
+    g->max_size = 1 << 20;
+    g->seed = 1;
+    g->rows = GEN_ROWS;
+    d->kind = SIZE_POWER;
+    d->a = 1;
+    d->lo = 16;
+    d->hi = 4096;
+
+    strncpy(buf, spec, MAXLINE - 1);
+    buf[MAXLINE - 1] = '\0';
+    for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+	ok = 0;
+	v = strchr(tok, '=');
+	if (v == NULL) 
+	    return 0;
+	*v++ = '\0';
+	if (!strcmp(tok, "ops"))
+	    ok = (g->ops = strtod(v, NULL)) > 0;
+	else if (!strcmp(tok, "live"))
+	    ok = (g->live = strtod(v, NULL)) >= 1;
+	else if (!strcmp(tok, "life")) {
+	    ok = 1;
+	    if (!strcmp(v, "exp"))
+		g->life = LIFE_EXP;
+	    else if (!strcmp(v, "const"))
+		g->life = LIFE_CONST;
+	    else if (sscanf(v, "pow:%lf", &g->life_a) == 1 && g->life_a > 1)
+		g->life = LIFE_POWER;
+	    else
+		ok = 0;
+	}
+	else if (!strcmp(tok, "size")) {
+	    if (sscanf(v, "uniform:%lf:%lf", &d->lo, &d->hi) == 2)
+		d->kind = SIZE_UNIFORM;
+	    else if (sscanf(v, "pow:%lf:%lf:%lf", &d->a, &d->lo, &d->hi) == 3)
+		d->kind = SIZE_POWER;
+	    else if (sscanf(v, "bimodal:%lf:%lf:%lf", &d->lo, &d->hi, &d->p) 
+		     == 3)
+		d->kind = SIZE_BIMODAL;
+	    else if (!strncmp(v, "hist:", 5) || !strncmp(v, "trace:", 6)) {
+		*strchr(v, ':') = '\0';
+		if (!gen_table(d, v, v + strlen(v) + 1))
+		    return 0;
+		d->kind = SIZE_TABLE;
+		d->lo = d->hi = 1;
+	    }
+	    else
+		return 0;
+	    ok = d->lo >= 1 && d->hi >= d->lo && d->hi <= INT_MAX && 
+		d->a > 0 && d->p >= 0 && d->p <= 1;
+	}
+	else if (!strcmp(tok, "realloc"))
+	    ok = sscanf(v, "%lf:%lf", &g->realloc_p, &g->growth) >= 1 &&
+		g->realloc_p >= 0 && g->realloc_p < 1 && g->growth > 0;
+	else if (!strcmp(tok, "max"))
+	    ok = (g->max_size = atoi(v)) > 0;
+	else if (!strcmp(tok, "seed")) {
+	    g->seed = strtoull(v, NULL, 0);
+	    ok = 1;
+	}
+	else if (!strcmp(tok, "rows"))
+	    ok = (g->rows = atoi(v)) > 0;
+	if (!ok)
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * gen_table - reads the sizes of a SIZE_TABLE distribution: from the
+ *     "<size> <weight>" lines of file for kind "hist", skipping any
+ *     other line, or from the mallocs and reallocs of trace file for
+ *     kind "trace", one weight each. Returns 0 if it finds no sizes.
+ */
+static int gen_table(sizedist_t *d, char *kind, char *file)
+{
+    char line[MAXLINE];
+    trace_t *trace = NULL;
+    FILE *fp = NULL;
+    double w, total = 0;
+    int i = 0, n = 0, size;
+
+    if (!strcmp(kind, "trace"))
+	trace = read_trace("", file);
+    else if ((fp = fopen(file, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in gen_table", file);
+	unix_error(msg);
+    }
+    while (1) {
+	if (trace) {
+	    if (i == trace->num_ops)
+		break;
+	    if (trace->ops[i].type == FREE) {
+		i++;
+		continue;
+	    }
+	    size = trace->ops[i++].size;
+	    w = 1;
+	}
+	else if (fgets(line, MAXLINE, fp) == NULL)
+	    break;
+	else if (sscanf(line, "%d %lf", &size, &w) != 2 || size < 1 || w <= 0)
+	    continue;
+	if (n == d->n) {
+	    d->n = d->n ? 2 * d->n : GEN_IDS;
+	    d->sizes = realloc(d->sizes, d->n * sizeof(int));
+	    d->cum = realloc(d->cum, d->n * sizeof(double));
+	    if (d->sizes == NULL || d->cum == NULL)
+		unix_error("realloc failed in gen_table");
+	}
+	d->sizes[n] = size;
+	d->cum[n++] = total += w;
+    }
+    if (trace)
+	free_trace(trace);
+    else
+	fclose(fp);
+    d->n = n;
+    return n > 0;
+}
+
+/* gen_reset - starts the workload of g over, with nothing live */
+static void gen_reset(gen_t *g)
+{
+    g->rng = g->seed;
+    g->issued = g->clock = 0;
+    g->nlive = g->nspare = g->num_ids = 0;
+    g->live_bytes = 0;
+}
+
+/*
+ * gen_next - the next request of the workload into op. A block is
+ *     freed once the clock reaches its death; any other request mallocs
+ *     a block, or reallocs a live one. Once ops requests are out, the
+ *     blocks still live are freed, and then it returns 0.
+ */
+static int gen_next(gen_t *g, traceop_t *op)
+{
+    double size;
+    int id;
+
+    /* Due blocks go first, and all of them at the end */
+    if (g->nlive > 0 && 
+	(g->issued >= g->ops || g->death[g->heap[0]] <= g->clock)) {
+	if (g->issued < g->ops)
+	    g->issued++;
+	id = gen_pop(g);
+	g->spare[g->nspare++] = id;
+	g->live_bytes -= g->size_of[id];
+	op->type = FREE;
+	op->index = id;
+	op->size = 0;
+	return 1;
+    }
+    if (g->issued >= g->ops)
+	return 0;
+    g->issued++;
+
+    if (g->nlive > 0 && g->realloc_p > 0 && gen_uniform(g) < g->realloc_p) {
+	id = g->heap[(int)(gen_uniform(g) * g->nlive)];
+	size = g->size_of[id] * g->growth;
+	size = size < 1 ? 1 : size > g->max_size ? g->max_size : size;
+	g->live_bytes = g->live_bytes - g->size_of[id] + (int)size;
+	g->size_of[id] = (int)size;
+	op->type = REALLOC;
+	op->index = id;
+	op->size = (int)size;
+	return 1;
+    }
+
+    /* A malloc, with an id a freed block had if there is one */
+    if (g->nspare > 0)
+	id = g->spare[--g->nspare];
+    else {
+	if (g->num_ids == g->cap) {
+	    g->cap = g->cap ? 2 * g->cap : GEN_IDS;
+	    g->death = realloc(g->death, g->cap * sizeof(long long));
+	    g->size_of = realloc(g->size_of, g->cap * sizeof(int));
+	    g->blocks = realloc(g->blocks, g->cap * sizeof(char *));
+	    g->heap = realloc(g->heap, g->cap * sizeof(int));
+	    g->spare = realloc(g->spare, g->cap * sizeof(int));
+	    if (!g->death || !g->size_of || !g->blocks || !g->heap || 
+		!g->spare)
+		unix_error("realloc failed in gen_next");
+	}
+	id = g->num_ids++;
+    }
+    g->size_of[id] = gen_size(g);
+    g->live_bytes += g->size_of[id];
+    g->death[id] = g->clock++ + gen_life(g);
+    gen_push(g, id);
+    op->type = ALLOC;
+    op->index = id;
+    op->size = g->size_of[id];
+    return 1;
+}
+
+/* gen_push - adds block id to the live blocks */
+static void gen_push(gen_t *g, int id)
+{
+    int i = g->nlive++, up;
+
+    for (; i > 0; i = up) {
+	up = (i - 1) / 2;
+	if (g->death[g->heap[up]] <= g->death[id])
+	    break;
+	g->heap[i] = g->heap[up];
+    }
+    g->heap[i] = id;
+}
+
+/* gen_pop - takes the live block that dies first out of the live blocks */
+static int gen_pop(gen_t *g)
+{
+    int top = g->heap[0], last = g->heap[--g->nlive];
+    int i = 0, c;
+
+    while ((c = 2 * i + 1) < g->nlive) {
+	if (c + 1 < g->nlive && g->death[g->heap[c + 1]] < g->death[g->heap[c]])
+	    c++;
+	if (g->death[last] <= g->death[g->heap[c]])
+	    break;
+	g->heap[i] = g->heap[c];
+	i = c;
+    }
+    g->heap[i] = last;
+    return top;
+}
+
+/* gen_uniform - the next of g's pseudo-random numbers, in [0, 1) */
+static double gen_uniform(gen_t *g)
+{
+    unsigned long long z = (g->rng += 0x9e3779b97f4a7c15ULL);  /* splitmix64 */
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return ((z ^ (z >> 31)) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* gen_size - a request size drawn from g's distribution */
+static int gen_size(gen_t *g)
+{
+    sizedist_t *d = &g->size;
+    double u = gen_uniform(g), want;
+    int lo, hi, mid;
+
+    switch (d->kind) {
+    case SIZE_UNIFORM:
+	return (int)(d->lo + u * (d->hi - d->lo + 1));
+    case SIZE_POWER:  /* the inverse of a power law cut off at lo and hi */
+	return (int)(d->lo / pow(1 - u * (1 - pow(d->lo / d->hi, d->a)), 
+				 1 / d->a));
+    case SIZE_BIMODAL:
+	return (int)(u < d->p ? d->lo : d->hi);
+    default:          /* first size whose running weight passes u's */
+	want = u * d->cum[d->n - 1];
+	for (lo = 0, hi = d->n - 1; lo < hi; ) {
+	    mid = (lo + hi) / 2;
+	    if (d->cum[mid] > want)
+		hi = mid;
+	    else
+		lo = mid + 1;
+	}
+	return d->sizes[lo];
+    }
+}
+
+/* gen_life - a lifetime in mallocs drawn from g's law, the mean live */
+static long long gen_life(gen_t *g)
+{
+    double u = gen_uniform(g), life;
+
+    switch (g->life) {
+    case LIFE_EXP:
+	life = -g->live * log(1 - u);
+	break;
+    case LIFE_POWER:  /* a Pareto law, scaled down to the same mean */
+	life = g->live * (g->life_a - 1) / g->life_a / 
+	    pow(1 - u, 1 / g->life_a);
+	break;
+    default:
+	life = g->live - 1;
+    }
+    return life < 1e18 ? (long long)life + 1 : (long long)1e18;
+}
+
+/*
+ * eval_gen - replays the workload of g straight from its generator and
+ *     prints, at rows points of the run and at its end, the live bytes,
+ *     the heap, the util so far (the peak of the live bytes over the
+ *     peak of the heap) and the throughput since the last row. A run of
+ *     the generator alone is timed first, and its time taken off.
+ */
+static void eval_gen(gen_t *g, char *spec)
+{
+    traceop_t op;
+    long long n, every;
+    double *dry, t0, t, last = 0, dry_last = 0, secs, total = 0;
+    size_t peak = 0;
+    char *p;
+    int k;
+
+    every = g->ops / g->rows > 0 ? g->ops / g->rows : 1;
+    if ((dry = calloc(g->rows + 1, sizeof(double))) == NULL)
+	unix_error("calloc failed in eval_gen");
+    gen_reset(g);
+    t0 = wall_secs();
+    for (n = 0, k = 0; gen_next(g, &op); )
+	if (++n == (k + 1) * every && k < g->rows)
+	    dry[k++] = wall_secs() - t0;
+    dry[k] = wall_secs() - t0;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_gen");
+    gen_reset(g);
+    printf("Workload %s:\n%14s%12s%12s%7s%10s\n", spec, "requests", 
+	   "live KB", "heap KB", "util", "Kops");
+    t0 = wall_secs();
+    for (n = 0, k = 0; gen_next(g, &op); ) {
+	n++;
+	if (op.type == FREE) {
+	    if (sized)
+		mm_free_sized(g->blocks[op.index], g->size_of[op.index]);
+	    else
+		mm_free(g->blocks[op.index]);
+	}
+	else {
+	    if (op.type == ALLOC)
+		p = mm_malloc(op.size);
+	    else
+		p = mm_realloc(g->blocks[op.index], op.size);
+	    if (p == NULL || !IS_ALIGNED(p)) {
+		printf("ERROR: mm_%s of %d bytes at request %lld %s, with "
+		       "%lu KB of heap (see -H)\n", op.type == ALLOC ? "malloc" : 
+		       "realloc", op.size, n, p ? "is not aligned" : "failed",
+		       (unsigned long)(mem_heapsize() / 1024));
+		errors++;
+		break;
+	    }
+	    g->blocks[op.index] = p;
+	    if (g->live_bytes > peak)
+		peak = g->live_bytes;
+	}
+	if (n == (k + 1) * every && k < g->rows) {
+	    t = wall_secs() - t0;
+	    secs = (t - last) - (dry[k] - dry_last);
+	    gen_row(g, n, every, secs, peak);
+	    total += secs;
+	    last = t;
+	    dry_last = dry[k++];
+	}
+    }
+    if (!errors) {
+	t = wall_secs() - t0;
+	secs = (t - last) - (dry[k] - dry_last);
+	if (n > k * every)
+	    gen_row(g, n, n - k * every, secs, peak);
+	total += secs;
+	printf("%lld requests in %.3f secs: %.0f Kops, %.0f%% util\n", n, 
+	       total, total > 0 ? n / total / 1e3 : 0.0, 
+	       100.0 * peak / mem_heap_peak());
+    }
+    free(dry);
+}
+
+/* 
+ * gen_row - a line of eval_gen's report, done requests into the run,
+ *     the last n of them in secs
+ */
+static void gen_row(gen_t *g, long long done, long long n, double secs,
+		    size_t peak)
+{
+    printf("%14lld%12lu%12lu%6.0f%%", done, 
+	   (unsigned long)(g->live_bytes / 1024), 
+	   (unsigned long)(mem_heapsize() / 1024), 
+	   mem_heap_peak() ? 100.0 * peak / mem_heap_peak() : 0.0);
+    if (secs > 0)
+	printf("%10.0f\n", n / secs / 1e3);
+    else
+	printf("%10s\n", "-");
+}
+
+/*
+ * write_gen - writes the requests of the workload of g to path as a
+ *     binary trace, which then replays like any other
+ */
+static void write_gen(gen_t *g, char *path)
+{
+    trace_t trace;
+    int max = 0;
+
+    memset(&trace, 0, sizeof(trace));
+    gen_reset(g);
+    while (1) {
+	if (trace.num_ops == max) {
+	    if (max == INT_MAX)
+		app_error("the workload is too long for a trace; replay it "
+			  "with -G alone");
+	    max = max < INT_MAX / 2 ? (max ? 2 * max : GEN_IDS) : INT_MAX;
+	    if ((trace.ops = realloc(trace.ops, max * sizeof(traceop_t))) 
+		== NULL)
+		unix_error("realloc failed in write_gen");
+	}
+	if (!gen_next(g, &trace.ops[trace.num_ops]))
+	    break;
+	trace.num_ops++;
+    }
+    trace.num_ids = g->num_ids;
+    trace.weight = 1;
+    write_trace(&trace, path);
+    free(trace.ops);
+}
+
+/*
+ * set_policy - passes a policy such as "best,addr,split=64,chunk=4096"
+ *     to mm_setopt one comma-separated setting at a time: a fit (good,
+ *     first, next or best), a list order (lifo or addr), the lists (seg
+ *     or single), split=, chunk=, slab= or quick=<bytes>. Returns 0 at
+ *     a setting mm.c does not take.
+ */
+static int set_policy(char *spec)
+{
+    static char *fits[] = {"good", "first", "next", "best"};
+    char buf[MAXLINE], *tok;
+    int i, ok;
+
+    strncpy(buf, spec, MAXLINE - 1);
+    buf[MAXLINE - 1] = '\0';
+    for (tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+	ok = 0;
+	for (i = 0; i < 4; i++)
+	    if (!strcmp(tok, fits[i]))
+		ok = mm_setopt(MM_FIT, MM_FIT_GOOD + i);
+	if (!strcmp(tok, "lifo"))
+	    ok = mm_setopt(MM_ORDER, MM_ORDER_LIFO);
+	else if (!strcmp(tok, "addr"))
+	    ok = mm_setopt(MM_ORDER, MM_ORDER_ADDR);
+	else if (!strcmp(tok, "seg"))
+	    ok = mm_setopt(MM_SEGLISTS, 1);
+	else if (!strcmp(tok, "single"))
+	    ok = mm_setopt(MM_SEGLISTS, 0);
+	else if (!strncmp(tok, "slab=", 5))
+	    ok = mm_setopt(MM_SLAB, atoi(tok + 5));
+	else if (!strncmp(tok, "quick=", 6))
+	    ok = mm_setopt(MM_QUICK, atoi(tok + 6));
+	else if (!strncmp(tok, "split=", 6))
+	    ok = mm_setopt(MM_SPLIT, atoi(tok + 6));
+	else if (!strncmp(tok, "chunk=", 6))
+	    ok = mm_setopt(MM_CHUNK, atoi(tok + 6));
+	if (!ok) {
+	    fprintf(stderr, "mdriver: bad policy setting '%s'\n", tok);
+	    return 0;
+	}
+    }
+    return 1;
+}
+
 /*
  * printresults - prints a performance summary for some malloc package
  */
@@ -926,17 +3097,23 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (spread)
+	printf("%10s%10s", "med(us)", "p99(us)");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (spread)
+		printf("%10.2f%10.2f", stats[i].median*1e6, stats[i].p99*1e6);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -1004,14 +3181,48 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsbzrLDX] [-f <file>] [-t <dir>] "
+	    "[-T <n>] [-A <n>] [-C <n>] [-w <file>]\n"
+	    "               [-G <spec>] [-H <MB>]\n"
+	    "               [-u <n>] [-q <n>] [-P <policy>] [-S <n> [-W <w>]] "
+	    "[-o <file>] [-j <n>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
-    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-A <n>     Split the heap into n arenas for -T.\n");
+    fprintf(stderr, "\t-b         Replay runs of mallocs and frees in batches.\n");
+    fprintf(stderr, "\t-C <n>     Count cache misses, also writing payloads "
+	    "and reading\n\t           the live ones every n requests.\n");
+    fprintf(stderr, "\t-D         With -T, divide the ids among threads.\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as a trace file; may be repeated.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
+    fprintf(stderr, "\t-G <spec>  Replay a synthetic workload instead, e.g. "
+	    "ops=1e8,live=1e5,\n\t           size=pow:1.5:16:4096,life=exp,"
+	    "realloc=0.05:1.5.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <MB>    Simulate a heap of <MB> megabytes "
+	    "(at most 4095).\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to n traces at once, each on "
+	    "its own cpu.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-o <file>  Write the samples of -u (binary if *.bin), "
+	    "or the policy\n\t           -S finds, to <file>.\n");
+    fprintf(stderr, "\t-L         Print per-request latency percentiles.\n");
+    fprintf(stderr, "\t-r         Allocate from one region per trace.\n");
+    fprintf(stderr, "\t-P <pol>   Placement policy, e.g. best,addr,split=64,"
+	    "chunk=4096.\n");
+    fprintf(stderr, "\t-q <n>     Free requests up to n bytes onto quick lists.\n");
+    fprintf(stderr, "\t-s         Use a single free list in mm.c.\n");
+    fprintf(stderr, "\t-S <n>     Search for the best -P policy, running n "
+	    "at a time.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace with 1..n threads.\n");
+    fprintf(stderr, "\t-u <n>     Sample the heap every n requests while "
+	    "measuring util.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <file>  Write the -f or -G trace to <file> in binary.\n");
+    fprintf(stderr, "\t-W <w>     Weight of util in the score of -S (%.2f).\n",
+	    UTIL_WEIGHT);
+    fprintf(stderr, "\t-X         With -T, free blocks in another thread.\n");
+    fprintf(stderr, "\t-z         Free with mm_free_sized.\n");
 }
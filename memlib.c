@@ -2,7 +2,16 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Built with -DMEM_MMAP, the storage is address space reserved with
+ * mmap instead: pages are committed as a brk moves up, decommitted as
+ * it moves back down, and mem_release hands interior pages back to the
+ * OS, so the process shrinks again after a peak.
+ *
+ * Either way, mem_map hands out separate regions from the OS for the
+ * biggest blocks; they count towards the heap size while they exist.
  */
+#define _GNU_SOURCE  /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,14 +19,39 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "memlib.h"
 #include "config.h"
 
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_brk[MEM_MAX_ARENAS]; /* points to last byte of each arena */
+static int mem_narenas = 1;  /* arenas the storage is split into */
+static size_t mem_max = MAX_HEAP; /* bytes of storage in all... */
+static size_t mem_span = MAX_HEAP; /* ... and per arena */
+static size_t mem_total = 0; /* bytes in all arenas and regions... */
+static size_t mem_peak = 0;  /* ... and the most there have been */
+static size_t mem_mapped = 0; /* bytes in regions from mem_map */
+
+/* A region from mem_map */
+typedef struct mem_region {
+    char *lo;                 /* first byte */
+    size_t len;               /* bytes, a multiple of the page size */
+    struct mem_region *next;
+} mem_region_t;
+static mem_region_t *mem_regions = NULL;
+static pthread_mutex_t mem_map_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef MEM_MMAP
+static char *mem_commit[MEM_MAX_ARENAS]; /* end of each arena's RW pages */
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+static void mem_commit_to(int a, char *brk);
+#endif
+
+#define COMMIT_STEP  (1 << 16) /* MEM_MMAP commits in steps of this many bytes */
+
+#define PAGE_DOWN(p) ((char *)((size_t)(p) & ~(mem_pagesize() - 1)))
+#define PAGE_UP(p)   PAGE_DOWN((char *)(p) + mem_pagesize() - 1)
 
 /* 
  * mem_init - initialize the memory system model
@@ -25,13 +59,30 @@ static char *mem_max_addr;   /* largest legal heap address */
 void mem_init(void)
 {
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+#ifdef MEM_MMAP
+    mem_start_brk = mmap(NULL, mem_max, PROT_NONE, 
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+#else
+    if ((mem_start_brk = (char *)malloc(mem_max)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
+
+    mem_set_arenas(1);                        /* heap is empty initially */
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+/* 
+ * mem_set_max - make the storage of the next mem_init bytes long, not
+ *    MAX_HEAP
+ */
+void mem_set_max(size_t bytes)
+{
+    mem_max = bytes;
 }
 
 /* 
@@ -39,7 +90,11 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
+#ifdef MEM_MMAP
+    munmap(mem_start_brk, mem_max);
+#else
     free(mem_start_brk);
+#endif
 }
 
 /*
@@ -47,27 +102,157 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int a;
+#ifdef MEM_MMAP
+    char *top = mem_start_brk;
+
+    /* Decommit by the old arena layout; mem_set_arenas may change it */
+    for (a = 0; a < MEM_MAX_ARENAS; a++)
+	if (mem_commit[a] > top)
+	    top = mem_commit[a];
+    if (top > mem_start_brk) {
+	madvise(mem_start_brk, top - mem_start_brk, MADV_DONTNEED);
+	mprotect(mem_start_brk, top - mem_start_brk, PROT_NONE);
+    }
+    for (a = 0; a < MEM_MAX_ARENAS; a++)
+	mem_commit[a] = a < mem_narenas ? mem_start_brk + a * mem_span : NULL;
+#endif
+
+    for (a = 0; a < mem_narenas; a++)
+	mem_brk[a] = mem_start_brk + a * mem_span;
+
+    /* Regions belong to the heap too, so they go with it */
+    while (mem_regions != NULL)
+	mem_unmap(mem_regions->lo, mem_regions->len);
+    mem_total = mem_peak = 0;
+}
+
+/*
+ * mem_account - add delta bytes to the heap size, and keep its
+ *    high-water mark for mem_heap_peak
+ */
+static void mem_account(long delta)
+{
+    size_t total = __atomic_add_fetch(&mem_total, delta, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (total > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, total, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_set_arenas - split the storage into n equal arenas, each with a
+ *    brk of its own, and empty them all. Returns -1 if n is out of range.
+ */
+int mem_set_arenas(int n)
+{
+    if (n < 1 || n > MEM_MAX_ARENAS)
+	return -1;
+    mem_narenas = n;
+    mem_span = (mem_max / n) & ~(size_t)(mem_pagesize() - 1);
+    mem_reset_brk();
+    return 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap again.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_arena(0, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
+#ifdef MEM_MMAP
+/*
+ * mem_commit_to - make the pages of arena a readable and writable up
+ *    to brk, rounded up to the next COMMIT_STEP, and no further,
+ *    dropping the contents of pages given up. The caller holds
+ *    mem_lock, or no other thread is running.
+ */
+static void mem_commit_to(int a, char *brk)
+{
+    char *end = mem_start_brk + (a + 1) * mem_span;
+    char *top = (char *)(((size_t)brk + COMMIT_STEP - 1) & 
+			 ~(size_t)(COMMIT_STEP - 1));
+
+    top = top < end ? PAGE_UP(top) : PAGE_UP(end);
+
+    if (top > mem_commit[a])
+	mprotect(mem_commit[a], top - mem_commit[a], PROT_READ | PROT_WRITE);
+    else if (top < mem_commit[a]) {
+	madvise(top, mem_commit[a] - top, MADV_DONTNEED);
+	mprotect(top, mem_commit[a] - top, PROT_NONE);
     }
-    mem_brk += incr;
+    mem_commit[a] = top;
+}
+#endif
+
+/*
+ * mem_sbrk_arena - mem_sbrk for arena a. Safe to call from several
+ *    threads at once: the brk only moves by compare-and-swap, and with
+ *    MEM_MMAP under mem_lock, so the pages are committed before anyone
+ *    can use them.
+ */
+void *mem_sbrk_arena(int a, int incr)
+{
+    char *old_brk;
+    char *min_addr = mem_start_brk + a * mem_span;
+    char *max_addr = min_addr + mem_span;
+
+#ifdef MEM_MMAP
+    pthread_mutex_lock(&mem_lock);
+#endif
+    old_brk = __atomic_load_n(&mem_brk[a], __ATOMIC_RELAXED);
+    do {
+	if (((old_brk + incr) < min_addr) || ((old_brk + incr) > max_addr)) {
+#ifdef MEM_MMAP
+	    pthread_mutex_unlock(&mem_lock);
+#endif
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+    } while (!__atomic_compare_exchange_n(&mem_brk[a], &old_brk,
+					  old_brk + incr, 1, __ATOMIC_RELAXED,
+					  __ATOMIC_RELAXED));
+#ifdef MEM_MMAP
+    mem_commit_to(a, old_brk + incr);
+    pthread_mutex_unlock(&mem_lock);
+#endif
+
+    mem_account(incr);
     return (void *)old_brk;
 }
 
+/*
+ * mem_release - tell the memory system that the pages wholly inside
+ *    the len bytes at lo hold nothing of value. With MEM_MMAP they go
+ *    back to the OS (and read as zero, or as before, once touched
+ *    again); otherwise this does nothing.
+ */
+void mem_release(void *lo, size_t len)
+{
+#ifdef MEM_MMAP
+    char *start = PAGE_UP(lo);
+    char *end = PAGE_DOWN((char *)lo + len);
+
+    if (end <= start)
+	return;
+#ifdef MADV_FREE
+    if (madvise(start, end - start, MADV_FREE) == 0)
+	return;
+#endif
+    madvise(start, end - start, MADV_DONTNEED);
+#else
+    (void)lo;
+    (void)len;
+#endif
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -77,19 +262,190 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte, the last byte of the
+ *    highest arena in use
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    int a;
+
+    for (a = mem_narenas - 1; a > 0; a--)
+	if (mem_arena_size(a) > 0)
+	    break;
+    return mem_arena_hi(a);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, over all arenas and
+ *    the regions from mem_map
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    int a;
+
+    for (a = 0; a < mem_narenas; a++)
+	size += mem_arena_size(a);
+    return size;
+}
+
+/*
+ * mem_heap_peak() - returns the most bytes the heap, regions included,
+ *    has held at once since the last reset. Equal to mem_heapsize() as
+ *    long as nothing shrinks the heap.
+ */
+size_t mem_heap_peak()
+{
+    return __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_map - get a region of len bytes, a multiple of the page size,
+ *    straight from the OS. Returns NULL if there is none.
+ */
+void *mem_map(size_t len)
+{
+    mem_region_t *r;
+    char *lo = mmap(NULL, len, PROT_READ | PROT_WRITE, 
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (lo == MAP_FAILED)
+	return NULL;
+    if ((r = malloc(sizeof(mem_region_t))) == NULL) {
+	munmap(lo, len);
+	return NULL;
+    }
+    r->lo = lo;
+    r->len = len;
+    pthread_mutex_lock(&mem_map_lock);
+    r->next = mem_regions;
+    mem_regions = r;
+    mem_mapped += len;
+    pthread_mutex_unlock(&mem_map_lock);
+    mem_account(len);
+    return lo;
+}
+
+/*
+ * mem_find_region - the link that points to the region starting at lo.
+ *    The caller holds mem_map_lock.
+ */
+static mem_region_t **mem_find_region(char *lo)
+{
+    mem_region_t **rp;
+
+    for (rp = &mem_regions; *rp != NULL; rp = &(*rp)->next)
+	if ((*rp)->lo == lo)
+	    return rp;
+    return NULL;
+}
+
+/*
+ * mem_unmap - give the region of len bytes at lo, from mem_map, back
+ *    to the OS
+ */
+void mem_unmap(void *lo, size_t len)
+{
+    mem_region_t **rp, *r;
+
+    pthread_mutex_lock(&mem_map_lock);
+    if ((rp = mem_find_region(lo)) == NULL) {
+	pthread_mutex_unlock(&mem_map_lock);
+	return;
+    }
+    r = *rp;
+    *rp = r->next;
+    mem_mapped -= len;
+    pthread_mutex_unlock(&mem_map_lock);
+    free(r);
+    munmap(lo, len);
+    mem_account(-(long)len);
+}
+
+/*
+ * mem_remap - resize the region of old_len bytes at lo, from mem_map,
+ *    to new_len bytes, moving it if need be. The contents are kept up
+ *    to the smaller of the two lengths, without copying where the OS
+ *    can remap the pages. Returns NULL and leaves the region alone if
+ *    there is no room.
+ */
+void *mem_remap(void *lo, size_t old_len, size_t new_len)
+{
+    mem_region_t **rp;
+    char *new_lo;
+
+#ifdef MREMAP_MAYMOVE
+    new_lo = mremap(lo, old_len, new_len, MREMAP_MAYMOVE);
+#else
+    new_lo = mmap(NULL, new_len, PROT_READ | PROT_WRITE, 
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (new_lo != MAP_FAILED) {
+	memcpy(new_lo, lo, old_len < new_len ? old_len : new_len);
+	munmap(lo, old_len);
+    }
+#endif
+    if (new_lo == MAP_FAILED)
+	return NULL;
+
+    pthread_mutex_lock(&mem_map_lock);
+    if ((rp = mem_find_region(lo)) != NULL) {
+	(*rp)->lo = new_lo;
+	(*rp)->len = new_len;
+    }
+    mem_mapped += new_len - old_len;
+    pthread_mutex_unlock(&mem_map_lock);
+    mem_account((long)new_len - (long)old_len);
+    return new_lo;
+}
+
+/*
+ * mem_is_mapped - true if the len bytes at p lie in one region from
+ *    mem_map
+ */
+int mem_is_mapped(void *p, size_t len)
+{
+    mem_region_t *r;
+    int found = 0;
+
+    pthread_mutex_lock(&mem_map_lock);
+    for (r = mem_regions; r != NULL && !found; r = r->next)
+	found = (char *)p >= r->lo && (char *)p + len <= r->lo + r->len;
+    pthread_mutex_unlock(&mem_map_lock);
+    return found;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of arena a
+ */
+void *mem_arena_lo(int a)
+{
+    return (void *)(mem_start_brk + a * mem_span);
+}
+
+/*
+ * mem_arena_hi - return address of the last heap byte of arena a
+ */
+void *mem_arena_hi(int a)
+{
+    return (void *)(__atomic_load_n(&mem_brk[a], __ATOMIC_RELAXED) - 1);
+}
+
+/*
+ * mem_arena_size - returns the heap size of arena a in bytes
+ */
+size_t mem_arena_size(int a)
+{
+    return (size_t)(__atomic_load_n(&mem_brk[a], __ATOMIC_RELAXED) -
+		    (mem_start_brk + a * mem_span));
+}
+
+/*
+ * mem_arena_span - returns the storage per arena; arena a spans the
+ *    mem_arena_span() bytes from a * mem_arena_span() after mem_heap_lo()
+ */
+size_t mem_arena_span()
+{
+    return mem_span;
 }
 
 /*
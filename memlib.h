@@ -1,11 +1,28 @@
 #include <unistd.h>
 
+#define MEM_MAX_ARENAS 16  /* most arenas the heap can be split into */
+
 void mem_init(void);               
+void mem_set_max(size_t bytes);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
 size_t mem_pagesize(void);
 
+int mem_set_arenas(int n);
+void *mem_sbrk_arena(int a, int incr);
+void *mem_arena_lo(int a);
+void *mem_arena_hi(int a);
+size_t mem_arena_size(int a);
+size_t mem_arena_span(void);
+void mem_release(void *lo, size_t len);
+
+void *mem_map(size_t len);
+void mem_unmap(void *lo, size_t len);
+void *mem_remap(void *lo, size_t old_len, size_t new_len);
+int mem_is_mapped(void *p, size_t len);
+
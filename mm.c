@@ -1,24 +1,91 @@
 /*
- * mm.c - Explicit free list implementation
+ * mm.c - Segregated explicit free list implementation
  * 
- * This implementation utilizies the explicit free list to keep track
- * of only the free blocks. This is an improvement from the free list
- * since the search for finding a free block is linear to the number of
- * free blocks in the heap, as opposed to all blocks in the heap. When
- * an allocated block is freed, it is put at the front of the free block
- * list, implementing an Last In First Out ordering. When allocating, if a
+ * This implementation keeps the free blocks in an array of explicit free
+ * lists, one per size class, indexed TLSF-style in two levels. The first
+ * level is the power of two of the block size and the second level splits
+ * each power of two into SL_COUNT equal ranges; blocks below 64 bytes get
+ * one exact class per 8 bytes. A bitmap of non-empty first level classes
+ * and one bitmap of non-empty second level classes per first level class
+ * sit next to the list roots, so find_fit rounds the request up to the
+ * next class boundary and picks the head of the first non-empty class at
+ * or above it with two bit scans, whatever the state of the heap.
+ *
+ * When an allocated block is freed, it is put at the front of its class
+ * list, implementing a Last In First Out ordering. When allocating, if a
  * block can be split for better utilization, the first part of the
- * original block becomes allocated and the second part stays free. 
- * This implementation only implements the simple version of realloc.
+ * original block becomes allocated and the second part goes back on the
+ * list of its (possibly smaller) class.
+ * With mm_setopt(MM_QUICK, n), freed heap blocks for requests of up to
+ * n bytes skip coalescing: they stay marked allocated on a quick list of
+ * their exact size, and a request of that size takes the last one back
+ * without a split. A find_fit that comes up empty, or QUICK_LIMIT blocks
+ * waiting in an arena, merges them all into the free lists at once.
+ * mm_realloc() resizes a block in place whenever its neighbours or the
+ * heap tail leave room, and copies only when the block has to move;
+ * mm_copies_avoided counts the in-place calls since mm_init().
  * 
- * In a free block, the original first payload byte holds the pointer that
- * points to the next free block, and the previous pointer is found a word
- * after that. Next is 0 when it is the last free block, and prev is 0 when
- * it is the first free block. The root pointer exists within the prologue
- * block.
+ * The original single explicit list is still available: calling
+ * mm_setopt(MM_SEGLISTS, 0) before mm_init() folds every size into
+ * class 0 (mdriver -s), so both can be compared on the same traces.
+ * The placement policy is an option too: MM_FIT trades the constant
+ * time good fit for first, next or best fit within the lists, MM_ORDER
+ * keeps the lists in address order instead of LIFO, and MM_SPLIT and
+ * MM_CHUNK set the smallest remainder worth splitting off and the
+ * smallest heap growth step. mm_init() fixes them for the whole heap,
+ * so the branches on them in the hot paths always go the same way.
+ *
+ * In a free block, the original first payload word holds the link to the
+ * next free block, and the link to the previous one is the word after
+ * that. Links are 32-bit offsets from the start of the heap, which never
+ * holds a block, so 0 ends a list; with a header and a footer word that
+ * makes the smallest block 16 bytes. Every payload is aligned to 16
+ * bytes. The root pointers of all the classes and both bitmaps exist
+ * within the prologue block.
+ *
+ * Only free blocks carry a footer. Bit 1 of every header records whether
+ * the previous block is allocated, so coalesce() reads the previous
+ * block's footer only when that block is free, and an allocated block
+ * needs nothing more than its header word in front of the payload.
+ *
+ * Requests of at most 64 bytes (MM_SLAB) skip all of that and come from
+ * slabs: SLAB_SIZE blocks carved out of the heap, each serving one slot
+ * size in 16-byte steps. Slab objects have no header. A slab keeps its
+ * freed slots on an intrusive list and hands out never-used slots with a
+ * bump pointer, so slab alloc and free are constant time. The payload of
+ * every slab block starts on a SLAB_SIZE boundary of the heap, so mm_free
+ * finds the slab of an object by masking its heap offset, and one bit per
+ * SLAB_SIZE page of the heap tells slab objects from ordinary blocks.
  *
- * Helper functions used to debug and print block information commented out
- * at bottom. Otherwise, code is heavily commented.
+ * The package is thread-safe. Each thread owns the slabs it carved, kept
+ * in a per-thread cache, so small requests and frees of its own objects
+ * take no lock. A thread freeing another thread's slab object pushes it
+ * on that slab's remote list with compare-and-swap, and the owner takes
+ * such slots back in batches before it carves a new slab. Everything
+ * else goes through the thread's arena under that arena's mutex. There
+ * is one arena unless mm_setopt(MM_ARENAS, n) asks for more: then
+ * memlib's storage is split into n equal regions, each a complete heap
+ * with its own prologue, class lists and brk. New thread caches are
+ * handed to the arenas round-robin, and a block's arena follows from its
+ * address with one division, so mm_free never searches. The cache of
+ * an exited thread, slabs and all, goes to the next thread that starts
+ * allocating. mm_init() must be called while no other thread is in mm.c;
+ * a generation count retires the thread caches of the previous heap.
+ *
+ * Compiling with -DTREE_FIT keeps free blocks of TREE_MIN (512) bytes and up
+ * in a splay tree ordered by (size, address) instead of their classes,
+ * so find_fit returns the tightest big block rather than the first one
+ * it meets, trading some speed for footprint. The tree links live where
+ * the list links do, at the start of the payload, but as whole pointers:
+ * blocks that big have the room.
+ *
+ * Compiling with -DMM_STATS keeps counters of the heap's work (growth,
+ * splits, merges, search lengths, free blocks per class) in each arena,
+ * updated under its lock where the work is done; mm_stats() adds them up
+ * with the heap's current shape. Without it the counters compile away.
+ *
+ * Compiling with -DDEBUG runs the heap checker mm_check() after every
+ * operation. Otherwise, code is heavily commented.
  *
  */
 #include <stdio.h>
@@ -26,6 +93,8 @@
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -43,11 +112,11 @@ team_t team = {
     "dajunjin2016@u.northwestern.edu"
 };
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
+/* payloads are aligned for 16-byte vector loads and stores */
+#define ALIGNMENT 16
 
 /* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(size_t)(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -58,9 +127,13 @@ team_t team = {
 #define WSIZE		4 	/* Word and header/foot size (bytes) */
 #define DSIZE		8	/* Double word size (bytes) */
 #define CHUNKSIZE 	(1<<8)	/* Extend heap by this amount (bytes) */
+#define CHUNKMAX	(1<<14)	/* ... at first, and by at most this much */
+#define SBRK_MAX	((size_t)INT_MAX & ~(size_t)(ALIGNMENT-1))
+				/* Most one mem_sbrk can move the break by */
 
 /* Returns max of x and y */
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc)) //alloc is lowest 3-bits
@@ -74,15 +147,27 @@ team_t team = {
 #define GET_SIZE(p) 	(GET(p) & ~0x7) //includes hdr & ptr
 #define GET_ALLOC(p)	(GET(p) & 0x1) //leaves first 3 lowest bits alone
 
+/* Header bit 1: the previous block is allocated (and has no footer) */
+#define PREV_ALLOC	0x2
+#define GET_PREV_ALLOC(p)	(GET(p) & PREV_ALLOC)
+#define SET_PREV_ALLOC(p)	PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)	PUT(p, GET(p) & ~PREV_ALLOC)
+
+/* Header bit 2: an allocated block that mm_realloc grew, and that keeps
+ * headroom for the next grow; free blocks never carry it */
+#define REALLOC_TAG	0x4
+#define GET_TAG(p)		(GET(p) & REALLOC_TAG)
+
 /* Given block ptr bp, compute address of its header and footer */
-//bp (block pointers) point to first payload byte
+//bp (block pointers) point to first payload byte, only free blocks
+//have a footer
 #define HDRP(bp) 	((char *)(bp) - WSIZE) //header is word in front
 #define FTRP(bp)	((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 			   //adding size of bp brings to next payload,
 			   //footer of orig. bp is 2 words before.
 
 /* Given block ptr bp, compute address of next and previous blocks
- * -- can be free or allocated  */
+ * -- next can be free or allocated, prev only when it is free  */
 #define NEXT_BLKP(bp)	((char *)(bp) + GET_SIZE((HDRP(bp)))) 
 #define PREV_BLKP(bp)	((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 			   //gets size from the footer of previous block
@@ -93,65 +178,453 @@ team_t team = {
  * New macros necessary for explicit free list
  */
 
-#define NEXT(bp)	(*(char **)(bp))
-#define PREV(bp)	(*((char **)(bp + WSIZE))) //HELLO
-#define SETNEXT(bp, nextaddr)	(NEXT(bp) = nextaddr)
-#define SETPREV(bp, prevaddr)	(PREV(bp) = prevaddr)
+#define PSIZE		sizeof(char *)	/* Size of a class root */
+#define LSIZE		4	/* Size of a free list link */
+
+/* A link is the offset of a block from heap_lo, 0 for none */
+#define TO_LINK(p)	((p) ? (unsigned int)((char *)(p) - heap_lo) : 0U)
+#define FROM_LINK(l)	((l) ? heap_lo + (l) : NULL)
+
+#define NEXT(bp)	FROM_LINK(*(unsigned int *)(bp))
+#define PREV(bp)	FROM_LINK(*(unsigned int *)((char *)(bp) + LSIZE))
+#define SETNEXT(bp, nextaddr)	(*(unsigned int *)(bp) = TO_LINK(nextaddr))
+#define SETPREV(bp, prevaddr)	\
+	(*(unsigned int *)((char *)(bp) + LSIZE) = TO_LINK(prevaddr))
+
+/***
+ * Macros for the segregated lists
+ */
+
+#define SL_LOG2		3	/* log2 of the second level classes */
+#define SL_COUNT	(1 << SL_LOG2)	/* ... per power of two */
+#define FL_COUNT	20	/* First level classes, the last ends at 32MB */
+#define SMALL_LOG2	(SL_LOG2 + 3)	/* Below 1<<6, exact 8-byte classes */
+#define NUM_CLASSES	(FL_COUNT * SL_COUNT)	/* Number of size classes */
+
+/* Root pointer of size class i, kept in the prologue payload */
+#define ROOT(i)		(*(char **)(arena->heap_p + (i)*PSIZE))
+
+/* Bitmap of non-empty first level classes, then one word per first
+ * level class for its non-empty second level classes */
+#define FL_BITMAP	(*(unsigned int *)(arena->heap_p + NUM_CLASSES*PSIZE))
+#define SL_BITMAP(fl)	(*(unsigned int *)(arena->heap_p + NUM_CLASSES*PSIZE \
+					   + (1 + (fl))*WSIZE))
+
+/* Index of the highest set bit of a nonzero word */
+#define FLS(x)		(31 - __builtin_clz(x))
+/* Index of the lowest set bit of a nonzero word */
+#define FFS(x)		(__builtin_ctz(x))
+
+#if NUM_CLASSES != MM_STAT_CLASSES
+#error "MM_STAT_CLASSES in mm.h must match NUM_CLASSES"
+#endif
+
+#ifdef TREE_FIT
+/* Free blocks this big sit in the best-fit tree, not in their class */
+#define TREE_MIN	(1 << 9)
+#define IN_TREE(size)	(seg_classes > 1 && (size) >= TREE_MIN)
+
+/* Children of a tree block, in place of its list links */
+#define LEFT(bp)	(*(char **)(bp))
+#define RIGHT(bp)	(*(char **)((char *)(bp) + PSIZE))
+#endif
+
+/***
+ * Macros for the slabs
+ */
+
+#define SLAB_SIZE	1024	/* Bytes per slab block, a power of two */
+#define SLAB_QUANTUM	ALIGNMENT	/* Slot sizes are multiples of this... */
+#define SLAB_CLASSES	4	/* ... up to SLAB_CLASSES*SLAB_QUANTUM */
+
+/* Slab class of a request of size bytes, and its slot size */
+#define SLAB_CLASS(size)	(((size) - 1) / SLAB_QUANTUM)
+#define SLAB_SLOT(cls)		(((cls) + 1) * SLAB_QUANTUM)
+
+/* Offset of p within its SLAB_SIZE page of the heap, and that page */
+#define PAGE_OFF(p)	((size_t)((char *)(p) - heap_lo) & (SLAB_SIZE-1))
+#define SLAB_OF(p)	((slab_t *)((char *)(p) - PAGE_OFF(p)))
+
+/* One bit per page of a 4GB heap, set while the page is a slab */
+#define PAGE_IDX(p)	((size_t)((char *)(p) - heap_lo) / SLAB_SIZE)
+#define SLAB_MAP_BYTES	((1UL << 32) / SLAB_SIZE / 8)
+#define IS_SLAB(p)	(__atomic_load_n(&slab_map[PAGE_IDX(p) >> 3], \
+				      __ATOMIC_RELAXED) & (1 << (PAGE_IDX(p) & 7)))
+#define SET_SLAB(p)	__atomic_fetch_or(&slab_map[PAGE_IDX(p) >> 3], \
+				  1 << (PAGE_IDX(p) & 7), __ATOMIC_RELAXED)
+#define CLR_SLAB(p)	__atomic_fetch_and(&slab_map[PAGE_IDX(p) >> 3], \
+				   ~(1 << (PAGE_IDX(p) & 7)), __ATOMIC_RELAXED)
+
+/***
+ * Macros for the quick lists
+ */
+
+#define QUICK_MAX	512	/* Largest MM_QUICK */
+#define QUICK_LIMIT	256	/* Blocks an arena holds before it merges them */
+
+/* One quick list per block size, indexed by size in ALIGNMENT steps */
+#define QUICK_LISTS	(ALIGN(QUICK_MAX + WSIZE) / ALIGNMENT + 1)
+#define QUICK(size)	(arena->quick[(size) / ALIGNMENT])
+
+struct tcache_t;
+
+/* Slab header, at the start of the slab block's payload */
+typedef struct slab_t {
+	struct slab_t *next;	/* next slab of the class with free slots */
+	struct slab_t *prev;	/* previous one */
+	char *free;		/* freed slots, linked through their first word */
+	char *bump;		/* slots from here on were never handed out */
+	struct tcache_t *owner;	/* thread cache the slab belongs to */
+	char *remote;		/* slots freed by other threads, not yet taken */
+	struct slab_t *pending;	/* next slab of the owner with remote slots */
+	int used;		/* slots handed out, remote ones included */
+	int slots;		/* slots in this slab */
+	int cls;		/* slab class */
+} slab_t;
+
+/* An arena: a heap of its own, with its own part of memlib's storage */
+typedef struct arena_t {
+	char *heap_p;		/* prologue payload: class roots, bitmaps */
+	size_t free_bytes;	/* bytes in blocks on the free lists */
+	size_t chunk;		/* current heap growth step */
+	size_t slab_top;	/* bytes of slab_map its slabs may have set */
+	char *rover[NUM_CLASSES]; /* where MM_FIT_NEXT resumes in each list */
+	char *quick[QUICK_LISTS]; /* freed blocks not merged yet, by size */
+	int nquick;		/* how many */
+	size_t quick_bytes;	/* bytes in them */
+#ifdef TREE_FIT
+	char *tree_root;	/* best-fit tree of the big free blocks */
+#endif
+	pthread_mutex_t lock;	/* held for every change to the arena */
+	int id;			/* memlib arena number */
+#ifdef MM_STATS
+	struct {
+		long nfree[NUM_CLASSES];	/* free blocks per class */
+		long sbrks, splits, merges, fits, fit_steps;
+		long quick_hits, quick_flushes;
+	} st;			/* counters since mm_init, for mm_stats */
+#endif
+} arena_t;
+
+/* Per-thread cache: the slabs of one thread, kept in an ordinary block */
+typedef struct tcache_t {
+	slab_t *partial[SLAB_CLASSES];	/* slabs with free slots */
+	slab_t *pending;	/* slabs other threads freed slots into */
+	struct tcache_t *next;	/* next cache left by an exited thread */
+	arena_t *arena;		/* arena the thread allocates from */
+} tcache_t;
+
+/* A region: the chunk being bump-allocated from, which links to the
+ * chunks before it through its first word */
+struct mm_region {
+	char *chunk;		/* newest chunk, NULL before the first alloc */
+	char *bump;		/* next free byte of it */
+	char *end;		/* first byte past it */
+	size_t next_size;	/* size of the next chunk */
+};
+
+/* Region chunks start this small and double up to REGION_MAX */
+#define REGION_MIN	(1 << 10)
+#define REGION_MAX	(1 << 16)
+#define CHUNK_PREV(c)	(*(char **)(c))
+
+/* Add n to counter c of the current arena, with -DMM_STATS */
+#ifdef MM_STATS
+#define STAT_ADD(c, n)	(arena->st.c += (n))
+#else
+#define STAT_ADD(c, n)
+#endif
+
+/* Arena that holds heap address p */
+#define ARENA_OF(p)	(&arenas[((char *)(p) - heap_lo) / arena_span])
+
+/* Lock arena a, which the heap functions then work on */
+#define LOCK(a)		(pthread_mutex_lock(&(a)->lock), arena = (a))
+#define UNLOCK()	pthread_mutex_unlock(&arena->lock)
 
 /***
  * Constants
  */
 
-#define MIN_BLKSIZE 16
+/* Header, footer and both links of a free block; allocated blocks
+ * need only the header but must become a free block again */
+#define MIN_BLKSIZE	ALIGN(DSIZE + 2*LSIZE)
+
+/* Free blocks this big shrink the heap or give their pages back */
+#define TRIM_DEFAULT	(1 << 17)
+
+/* Requests this big get a region of their own from mem_map */
+#define MMAP_DEFAULT	(1 << 18)
+
+/* A mapped block: the region's length, then the payload */
+#define MAP_OVERHEAD	ALIGN(sizeof(size_t))
+#define MAP_LEN(bp)	(*(size_t *)((char *)(bp) - MAP_OVERHEAD))
+#define MAP_LENGTH(size) (((size) + MAP_OVERHEAD + page_size - 1) & \
+			  ~(page_size - 1))
+
+/* True if bp lies in one of the arenas, not in a region of its own */
+#define IN_HEAP(bp)	((size_t)((char *)(bp) - heap_lo) < heap_bytes)
+
+/* Prologue header and footer around the class roots and bitmaps, and
+ * the padding in front of it that aligns every payload after it */
+#define PROLOGUE_SIZE	ALIGN(DSIZE + NUM_CLASSES*PSIZE + (1+FL_COUNT)*WSIZE)
+#define PROLOGUE_PAD	(ALIGNMENT - WSIZE)
 
 /***
  * Globals
  */
 
-static char *heap_p  = NULL; /* will point to prologue block */
+static arena_t arenas[MEM_MAX_ARENAS]; /* the arenas in use... */
+static int narenas = 1; /* ... how many */
+static int opt_arenas = 1; /* MM_ARENAS, applied by mm_init */
+static size_t arena_span; /* bytes between arenas */
+static __thread arena_t *arena = NULL; /* arena whose lock is held */
+static int seg_classes = NUM_CLASSES; /* classes in use, 1 = single list */
+static int opt_seglists = 1; /* MM_SEGLISTS, applied by mm_init */
+static char *heap_lo = NULL; /* first heap byte, slab pages count from here */
+static size_t heap_bytes; /* storage of all the arenas together */
+static size_t page_size; /* mapped regions come in multiples of this */
+static size_t slab_max = SLAB_CLASSES*SLAB_QUANTUM; /* largest slab request */
+static int opt_slab = SLAB_CLASSES*SLAB_QUANTUM; /* MM_SLAB */
+static size_t trim_min = TRIM_DEFAULT; /* smallest block released, 0 = none */
+static int opt_trim = TRIM_DEFAULT; /* MM_TRIM */
+static size_t mmap_min = MMAP_DEFAULT; /* smallest mapped request, 0 = none */
+static int opt_mmap = MMAP_DEFAULT; /* MM_MMAP */
+static int fit_policy = MM_FIT_GOOD; /* how find_fit picks a block */
+static int opt_fit = MM_FIT_GOOD; /* MM_FIT */
+static int addr_order = 0; /* lists sorted by address rather than LIFO */
+static int opt_order = MM_ORDER_LIFO; /* MM_ORDER */
+static size_t split_min = MIN_BLKSIZE; /* smallest remainder split off */
+static int opt_split = 0; /* MM_SPLIT */
+static size_t chunk_min = CHUNKSIZE; /* smallest heap growth step */
+static int opt_chunk = CHUNKSIZE; /* MM_CHUNK */
+static size_t quick_max = 0; /* largest block on quick lists, 0 = none */
+static int opt_quick = 0; /* MM_QUICK */
+static unsigned char slab_map[SLAB_MAP_BYTES]; /* pages that are slabs */
+long mm_copies_avoided = 0; /* reallocs done without a copy */
+static pthread_once_t mm_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* hands a thread's cache back at exit */
+static unsigned int heap_gen = 0; /* bumped by every mm_init */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static tcache_t *orphans = NULL; /* caches of exited threads */
+static int next_arena = 0; /* arena for the next new thread cache */
+static __thread tcache_t *tcache = NULL; /* this thread's cache... */
+static __thread unsigned int tcache_gen = 0; /* ... if this is heap_gen */
 
 /***
  * Function protoypes
  */
 
+static int arena_init(void);
 static void *extend_heap(size_t size);
+static void *grow_heap(size_t asize);
+static void *heap_alloc(size_t asize);
 static void *coalesce(void *bp);
 static void *find_fit(size_t asize);
+static void *list_fit(int i, size_t asize);
 static void place(void *bp, size_t size);
+static void place_run(void *bp, size_t asize, int n, void **out);
+static void sort_ptrs(void **ptrs, int n);
 static void rmv_from_list(void *bp);
 static void insert_front_list(void *bp);
-//static int mm_check();
-//static void block_data(void* bp);
+static void mapping(size_t size, int *fl, int *sl);
+static int size_class(size_t size);
+#ifdef MM_STATS
+static int stat_class(size_t size);
+#endif
+static void free_block(void *bp);
+static void merge_block(void *bp);
+static void quick_flush(void);
+static void release_block(void *bp, char *lo, char *hi);
+static void *map_alloc(size_t size);
+static void *map_realloc(void *bp, size_t size);
+static void shrink_block(void *bp, size_t asize);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+static slab_t *slab_new(tcache_t *tc, int cls);
+static void slab_release(slab_t *s);
+static char *slab_page(void);
+static void slab_link(slab_t *s);
+static void slab_unlink(slab_t *s);
+static void slab_drain(tcache_t *tc);
+static tcache_t *my_tcache(void);
+static tcache_t *tcache_get(void);
+static void mm_once_init(void);
+static void tcache_exit(void *tc);
+#ifdef TREE_FIT
+static int tree_cmp(size_t size, char *bp, char *t);
+static char *splay(char *t, size_t size, char *bp);
+static void tree_insert(void *bp);
+static void tree_remove(void *bp);
+static void *tree_fit(size_t asize);
+#endif
+#ifdef DEBUG
+static int mm_check(void);
+static void block_data(void *bp);
+#ifdef TREE_FIT
+static int tree_check(char *t, char **last, long *count, size_t *bytes);
+#endif
+static void check_arenas(void);
+#define CHECKHEAP()	check_arenas()
+#else
+#define CHECKHEAP()
+#endif
+
+/*
+ * mm_setopt - set an allocator option, which takes effect at the
+ *     next mm_init. Returns 1 on success, 0 for an unknown option.
+ */
+int mm_setopt(int param, int value)
+{
+	switch (param)
+	{
+	case MM_SEGLISTS:
+		opt_seglists = value;
+		return 1;
+	case MM_SLAB:
+		if (value < 0 || value > SLAB_CLASSES*SLAB_QUANTUM)
+			return 0;
+		opt_slab = value;
+		return 1;
+	case MM_ARENAS:
+		if (value < 1 || value > MEM_MAX_ARENAS)
+			return 0;
+		opt_arenas = value;
+		return 1;
+	case MM_TRIM:
+		if (value < 0)
+			return 0;
+		opt_trim = value;
+		return 1;
+	case MM_MMAP:
+		/* a slab size is never mapped: mm_free_sized counts on it */
+		if (value < 0 || (value > 0 && value <= SLAB_CLASSES*SLAB_QUANTUM))
+			return 0;
+		opt_mmap = value;
+		return 1;
+	case MM_QUICK:
+		if (value < 0 || value > QUICK_MAX)
+			return 0;
+		opt_quick = value;
+		return 1;
+	case MM_FIT:
+		if (value < MM_FIT_GOOD || value > MM_FIT_BEST)
+			return 0;
+		opt_fit = value;
+		return 1;
+	case MM_ORDER:
+		if (value != MM_ORDER_LIFO && value != MM_ORDER_ADDR)
+			return 0;
+		opt_order = value;
+		return 1;
+	case MM_SPLIT:
+		if (value < 0 || value > CHUNKMAX)
+			return 0;
+		opt_split = value;
+		return 1;
+	case MM_CHUNK:
+		if (value < 1 || value > CHUNKMAX)
+			return 0;
+		opt_chunk = value;
+		return 1;
+	default:
+		return 0;
+	}
+}
 
 /* 
- * mm_init - initialize the malloc package.
+ * mm_init - initialize the malloc package. Unlike the other calls it
+ *     must not run while another thread is inside mm.c.
  */
 int mm_init(void)
 {
+	int i;
+
+	seg_classes = opt_seglists ? NUM_CLASSES : 1;
+	slab_max = opt_slab;
+	trim_min = opt_trim;
+	mmap_min = opt_mmap;
+	quick_max = opt_quick ? MAX(ALIGN(opt_quick + WSIZE), MIN_BLKSIZE) : 0;
+	fit_policy = opt_fit;
+	addr_order = opt_order == MM_ORDER_ADDR;
+	split_min = MAX(ALIGN(opt_split), MIN_BLKSIZE);
+	chunk_min = MAX(ALIGN(opt_chunk), MIN_BLKSIZE);
+
+	/* Every thread cache and slab of the last heap is gone */
+	pthread_once(&mm_once, mm_once_init);
+	heap_gen++;
+	orphans = NULL;
+	next_arena = 0;
+	for (i = 0; i < narenas; i++)
+		memset(slab_map, 0, arenas[i].slab_top);
+	mm_copies_avoided = 0;
+
+	/* Split memlib's storage into the arenas */
+	if (mem_set_arenas(opt_arenas) < 0)
+		return -1;
+	narenas = opt_arenas;
+	arena_span = mem_arena_span();
+	heap_lo = mem_heap_lo();
+	heap_bytes = narenas * arena_span;
+	page_size = mem_pagesize();
+
+	for (i = 0; i < narenas; i++)
+	{
+		arena = &arenas[i];
+		arena->id = i;
+		if (arena_init() < 0)
+			return -1;
+	}
+	CHECKHEAP();
+   	return 0; 
+}
+
+/*
+ * arena_init - sets up the empty heap of the current arena
+ */
+static int arena_init(void)
+{
+	int i;
+
+	arena->chunk = chunk_min;
+	arena->slab_top = 0;
+	arena->free_bytes = 0;
+	for (i = 0; i < NUM_CLASSES; i++)
+		arena->rover[i] = NULL;
+	for (i = 0; i < QUICK_LISTS; i++)
+		arena->quick[i] = NULL;
+	arena->nquick = 0;
+	arena->quick_bytes = 0;
+#ifdef TREE_FIT
+	arena->tree_root = NULL;
+#endif
+#ifdef MM_STATS
+	memset(&arena->st, 0, sizeof(arena->st));
+#endif
+
 	/* Create the initial empty heap */
-	if ((heap_p = mem_sbrk(6*WSIZE)) == (void *)-1)
+	if ((arena->heap_p = mem_sbrk_arena(arena->id,
+		 PROLOGUE_PAD + PROLOGUE_SIZE + WSIZE)) == (void *)-1)
 		return -1;
-	PUT(heap_p, 0); /* Alignment padding */
-	PUT(heap_p + (1*WSIZE), PACK(MIN_BLKSIZE, 1)); /* Prologue header */
-	/* Root information stored in prologue block */
-	PUT(heap_p + (2*WSIZE), 0); /* Root has no next yet */
-	PUT(heap_p + (3*WSIZE), 0); /* No prev */
-	PUT(heap_p + (4*WSIZE), PACK(MIN_BLKSIZE, 1)); /* Prologue footer */
-	PUT(heap_p + (5*WSIZE), PACK(0, 1)); /* Epilogue header */
-	heap_p += DSIZE; /* Now points to prologue footer */
+	memset(arena->heap_p, 0, PROLOGUE_PAD); /* Alignment padding */
+	PUT(arena->heap_p + PROLOGUE_PAD, PACK(PROLOGUE_SIZE, 1)); /* Prologue header */
+	arena->heap_p += ALIGNMENT; /* Now points to prologue payload */
+
+	/* Root information stored in prologue block, no free blocks yet */
+	for (i = 0; i < NUM_CLASSES; i++)
+		ROOT(i) = NULL;
+	FL_BITMAP = 0;
+	for (i = 0; i < FL_COUNT; i++)
+		SL_BITMAP(i) = 0;
+	PUT(FTRP(arena->heap_p), PACK(PROLOGUE_SIZE, 1)); /* Prologue footer */
+	/* Epilogue header, follows the allocated prologue */
+	PUT(HDRP(NEXT_BLKP(arena->heap_p)), PACK(0, 1 | PREV_ALLOC));
 
 	/************ EXTEND THE EMPTY HEAP ********/
-	if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+	/* extend_heap puts the first free block on its list */
+	if (extend_heap(chunk_min/WSIZE) == NULL)
 		return -1;
-	/* Root points to first free block (after prologue) */
-	SETNEXT(heap_p, NEXT_BLKP(heap_p));
-
-	/* bp at first free block */
-	char *bp = NEXT(heap_p);
-	SETNEXT(bp, 0); /* no next ptr yet */
-	SETPREV(bp, 0); /* no prev ptr */
-	//mm_check();
-   	return 0; 
+	return 0;
 }
 
 static void *extend_heap(size_t words)
@@ -159,13 +632,17 @@ static void *extend_heap(size_t words)
 	char *bp;
 	size_t size;
 
-	/* Allocate an even number of words to maintain alignment */
-	size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-	if ((long)(bp = mem_sbrk(size)) == -1)
+	/* Allocate whole ALIGNMENT units to maintain alignment */
+	size = ALIGN(words * WSIZE);
+	if (size > SBRK_MAX)
 		return NULL;
+	if ((long)(bp = mem_sbrk_arena(arena->id, size)) == -1)
+		return NULL;
+	STAT_ADD(sbrks, 1);
 
-	/* Initialize free block header/footer and the epilogue header */
-	PUT(HDRP(bp), PACK(size, 0));
+	/* Initialize free block header/footer and the epilogue header;
+	 * the old epilogue header knew whether the last block is allocated */
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
 	PUT(FTRP(bp), PACK(size, 0));
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
 	
@@ -173,10 +650,43 @@ static void *extend_heap(size_t words)
 	return coalesce(bp);
 }
 
-/* Coalesce; returns bp of the free block */
+/*
+ * grow_heap - extends the heap for a block of asize bytes that no free
+ *     block holds. A free block at the end of the heap grows by just the
+ *     shortfall. Otherwise the heap grows by the adaptive step, which
+ *     doubles while the heap keeps running out and halves again (down to
+ *     MM_CHUNK) when a quarter of the heap sits free but in the wrong
+ *     places. The step stays under CHUNKMAX and 1/64 of the heap, so
+ *     the last extension overshoots the peak by little.
+ */
+static void *grow_heap(size_t asize)
+{
+	char *epi = (char *)mem_arena_hi(arena->id) + 1;
+	size_t heapsize = mem_arena_size(arena->id);
+	size_t tail;
+
+	if (!GET_PREV_ALLOC(HDRP(epi)))
+	{
+		tail = GET_SIZE(HDRP(PREV_BLKP(epi)));
+		if (tail >= asize)
+			return PREV_BLKP(epi);
+		return extend_heap((asize - tail)/WSIZE);
+	}
+
+	if (arena->free_bytes > heapsize / 4)
+		arena->chunk = MAX(arena->chunk / 2, chunk_min);
+	else
+		arena->chunk = MIN(arena->chunk * 2, MAX(chunk_min,
+				MIN(CHUNKMAX, heapsize / 64)));
+	return extend_heap(MAX(asize, arena->chunk)/WSIZE);
+}
+
+/* Coalesce; returns bp of the free block. The merged block always
+ * follows an allocated block, and the block after it already has its
+ * prev-allocated bit clear. */
 static void *coalesce(void *bp)
 {
-	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
 	size_t size = GET_SIZE(HDRP(bp));
 	
@@ -188,31 +698,34 @@ static void *coalesce(void *bp)
 
 	else if (prev_alloc && !next_alloc)
 	{
+		STAT_ADD(merges, 1);
 		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
 		rmv_from_list(NEXT_BLKP(bp));
-		PUT(HDRP(bp), PACK(size, 0));
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
 		PUT(FTRP(bp), PACK(size, 0));
 		insert_front_list(bp);
 	}
 
 	else if (!prev_alloc && next_alloc)
 	{
+		STAT_ADD(merges, 1);
 		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
 		bp = PREV_BLKP(bp);
 		rmv_from_list(bp);
-		PUT(HDRP(bp), PACK(size, 0));
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
 		PUT(FTRP(bp), PACK(size, 0));
 		insert_front_list(bp);
 	}
 
 	else
 	{
+		STAT_ADD(merges, 2);
 		size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
 			GET_SIZE(HDRP(NEXT_BLKP(bp)));
 		rmv_from_list(PREV_BLKP(bp));
 		rmv_from_list(NEXT_BLKP(bp));
 		bp = PREV_BLKP(bp);
-		PUT(HDRP(bp), PACK(size, 0));
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
 		PUT(FTRP(bp), PACK(size, 0));
 		insert_front_list(bp);
 	}
@@ -223,64 +736,63 @@ static void place(void *bp, size_t asize)
 {
 	size_t csize = GET_SIZE(HDRP(bp)); /* size of free block */
 
-	/* If difference is more at least  minimum block size, split */
-	if ((csize - asize) >= MIN_BLKSIZE)
+	/* unlink while the header still names the block's class */
+	rmv_from_list(bp);
+
+	/* If the rest is worth a block of its own, split */
+	if ((csize - asize) >= split_min)
 	{
-		/* new size changes where next is */
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+		STAT_ADD(splits, 1);
+		/* new size changes where next is, no footer once allocated;
+		 * a free block always follows an allocated one */
+		PUT(HDRP(bp), PACK(asize, 1 | PREV_ALLOC));
 		
-		/* new free block pointer */
-		char *nfbp = NEXT_BLKP(bp);
-		if (PREV(bp) && NEXT(bp))
-		/* if it wasn't the first or last block */
-		{
-			char *orig_next = NEXT(bp);
-			char *orig_prev = PREV(bp);
-			/* Give new free block the old next and prev */
-			SETNEXT(nfbp, orig_next);
-			SETPREV(nfbp, orig_prev);
-			
-			/* Old next and prev point to new block */
-			SETNEXT(orig_prev, nfbp);
-			SETPREV(orig_next, nfbp);
-		}	
-		/* if first free block */
-		else if (!(PREV(bp)) && NEXT(bp))
-		{
-			char *orig_next = NEXT(bp);
-			SETNEXT(heap_p, nfbp);
-			SETPREV(nfbp, 0);
-			SETNEXT(nfbp, orig_next);
-			SETPREV(orig_next, nfbp);
-		}
-		/* if last free block */
-		else if (PREV(bp) && !(NEXT(bp)))
-		{
-			char *orig_prev = PREV(bp);
-			SETNEXT(orig_prev, nfbp);
-			SETNEXT(nfbp, 0);
-			SETPREV(nfbp, orig_prev);
-		}
-		else /* if it's the only block */
-		{
-			SETNEXT(heap_p, nfbp);
-			SETNEXT(nfbp, 0);
-			SETPREV(nfbp, 0);
-		}
 		/* new free block pointer allocated bit and size */
-		PUT(HDRP(nfbp), PACK(csize-asize, 0));
+		char *nfbp = NEXT_BLKP(bp);
+		PUT(HDRP(nfbp), PACK(csize-asize, PREV_ALLOC));
 		PUT(FTRP(nfbp), PACK(csize-asize, 0));
+
+		/* remainder goes on the list of its own class */
+		insert_front_list(nfbp);
 	}
 	/* no splitting */
 	else
 	{	
-		rmv_from_list(bp);
-		PUT(HDRP(bp), PACK(csize, 1));
-        PUT(FTRP(bp), PACK(csize, 1));
+		PUT(HDRP(bp), PACK(csize, 1 | PREV_ALLOC));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
 	}
 }
 
+/* place_run - carves n blocks of asize bytes, one after the other, from
+ * the front of free block bp into out; place for a whole run at once */
+static void place_run(void *bp, size_t asize, int n, void **out)
+{
+	size_t rest = GET_SIZE(HDRP(bp)) - n * asize;
+	char *p = bp;
+	int i;
+
+	rmv_from_list(bp);
+	for (i = 0; i < n; i++)
+	{
+		/* the last block takes a remainder too small to split off */
+		if (i == n - 1 && rest < split_min)
+			asize += rest;
+		PUT(HDRP(p), PACK(asize, 1 | PREV_ALLOC));
+		out[i] = p;
+		p = NEXT_BLKP(p);
+	}
+
+	if (rest >= split_min)
+	{
+		STAT_ADD(splits, 1);
+		PUT(HDRP(p), PACK(rest, PREV_ALLOC));
+		PUT(FTRP(p), PACK(rest, 0));
+		insert_front_list(p);
+	}
+	else
+		SET_PREV_ALLOC(HDRP(p));
+}
+
 /* 
  * mm_malloc - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
@@ -289,8 +801,8 @@ static void place(void *bp, size_t asize)
 void *mm_malloc(size_t size)
 {
 	size_t adjsize; /* Adjusted block size */
-	size_t extsize; /* Amount to extend heap if no fit */
 	char *bp;	
+	tcache_t *tc;
 
 	/* Ignore spurious requests */
 	if (size == 0)
@@ -298,266 +810,1656 @@ void *mm_malloc(size_t size)
 		return NULL;
 	}
 	
-	/* Adjust block size to include overhead and alignment reqs. */
-	if (size <= DSIZE)
-		adjsize = 2*DSIZE;
-	else
-		adjsize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+	/* Huge requests stay out of the heap altogether */
+	if (mmap_min && size >= mmap_min)
+		return map_alloc(size);
 
-	/* Search the free list for a fit */
-	if ((bp = find_fit(adjsize)) != NULL)
+	/* Small requests are slab objects of the calling thread */
+	if (size <= slab_max)
 	{
-		place(bp, adjsize);
+		bp = slab_alloc(size);
+		CHECKHEAP();
 		return bp;
-		/* returns pointer to allocated block */
 	}
-	
-	extsize = MAX(adjsize, CHUNKSIZE);
-	/* need more than chunk? */
-	if ((bp = extend_heap(extsize/WSIZE)) == NULL)
-	{
-		printf("extend_heap failed \n");
+
+	/* Adjust block size to include the header and alignment reqs.;
+	 * the footer only exists while the block is free */
+	adjsize = MAX(ALIGN(size + WSIZE), MIN_BLKSIZE);
+
+	/* from the arena of the calling thread */
+	if ((tc = my_tcache()) == NULL)
 		return NULL;
-	}
-	place(bp, adjsize);
+	LOCK(tc->arena);
+	bp = heap_alloc(adjsize);
+	UNLOCK();
+	CHECKHEAP();
 	return bp;
 }
 
-static void *find_fit(size_t asize)
+/*
+ * heap_alloc - allocates a block of asize bytes from the free lists or
+ *     else from new heap; the caller holds the heap lock
+ */
+static void *heap_alloc(size_t asize)
 {
 	char *bp;
-	int done = 0;
-	/* start at first free block, */
-	if (!(NEXT(heap_p)))
+
+	/* A block of just this size may wait on its quick list */
+	if (asize <= quick_max && (bp = QUICK(asize)) != NULL)
 	{
-		return NULL;
+		STAT_ADD(quick_hits, 1);
+		QUICK(asize) = NEXT(bp);
+		arena->nquick--;
+		arena->quick_bytes -= asize;
+		return bp;
 	}
-	else
+
+	/* Search the free list for a fit, with the quick lists merged in
+	 * if there is none */
+	if ((bp = find_fit(asize)) == NULL && arena->nquick)
 	{
-		bp = NEXT(heap_p);
+		quick_flush();
+		bp = find_fit(asize);
 	}
-	do
+	if (bp == NULL && (bp = grow_heap(asize)) == NULL)
 	{
-		if (asize <= GET_SIZE(HDRP(bp)))
-		{
-			return bp;
-		}
-		else if (NEXT(bp) != 0)
-		{
-			bp = NEXT(bp);
-		}
-		else
-		{
-			done = 1;
-		}
-	} while (done != 1);
-	return NULL;
+		printf("extend_heap failed \n");
+		return NULL;
+	}
+	place(bp, asize);
+	return bp;
+	/* returns pointer to allocated block */
 }
 
 /*
- * mm_free - Freeing with LIFO policy
+ * mm_malloc_batch - allocates n blocks of size bytes into out and
+ *     returns how many it got. Heap blocks are carved one after the
+ *     other from a single free block that holds them all, with one
+ *     split and one list update for the lot. Without such a block they
+ *     are found one by one, still under a single lock; slab and
+ *     mapped sizes always go one at a time.
  */
-void mm_free(void *bp)
+int mm_malloc_batch(size_t size, int n, void **out)
 {
+	size_t asize;
+	char *bp;
+	tcache_t *tc;
+	int i;
 
-	/* size should be double word aligned */
-	size_t size = GET_SIZE(HDRP(bp));	
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
-	coalesce(bp);
+	if (size == 0 || size <= slab_max || (mmap_min && size >= mmap_min))
+	{
+		for (i = 0; i < n; i++)
+			if ((out[i] = mm_malloc(size)) == NULL)
+				break;
+		return i;
+	}
+
+	asize = MAX(ALIGN(size + WSIZE), MIN_BLKSIZE);
+	if ((tc = my_tcache()) == NULL)
+		return 0;
+	LOCK(tc->arena);
+	if (n > 1 && (bp = find_fit(n * asize)) != NULL)
+		place_run(bp, asize, n, out);
+	else
+		for (i = 0; i < n; i++)
+			if ((out[i] = heap_alloc(asize)) == NULL)
+			{
+				n = i;
+				break;
+			}
+	UNLOCK();
+	CHECKHEAP();
+	return n;
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * find_fit - good fit in constant time: after trying the head of the
+ *     request's own class, the request is rounded up to the next class
+ *     boundary, so the head of any non-empty class at or above it is big
+ *     enough without looking at its size. Only the last class, which is
+ *     open-ended, and the single list mode are searched, by list_fit.
+ *     The other MM_FIT policies search the request's own class with
+ *     list_fit instead of trying its head, and best fit also searches
+ *     the class it settles on for its smallest block.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void *find_fit(size_t asize)
 {
-    void *oldptr = ptr;
-    void *newptr;
-    size_t copySize;
-	size_t adjsize;
-
-	adjsize = ALIGN(size);
-    newptr = mm_malloc(size);
-
-    if (newptr == NULL)
-      return NULL;
-
-    copySize = GET_SIZE(HDRP(oldptr));
-
-    if (adjsize < copySize)
-      copySize = adjsize;
+	char *bp;
+	unsigned int fl_map, sl_map;
+	int fl, sl;
 
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
-    return newptr;
-	
-}
+	STAT_ADD(fits, 1);
+	if (seg_classes == 1)
+		return list_fit(0, asize);
 
-static void rmv_from_list(void *bp)
-{
-	if (PREV(bp) && NEXT(bp))
-	{
-                char *orig_prev = PREV(bp);
-                char *orig_next = NEXT(bp);
-                SETNEXT(orig_prev, orig_next);
-                SETPREV(orig_next, orig_prev);
-        }
-
-        else if (!(PREV(bp)) && NEXT(bp))
-        {
-                char *orig_next = NEXT(bp);
-                SETNEXT(heap_p, orig_next);
-                SETPREV(orig_next, 0);
-        }
-
-        else if (PREV(bp) && !(NEXT(bp)))
-        {
-                char *orig_prev = PREV(bp);
-                SETNEXT(orig_prev, 0);
-        }
-
-        else
-        {
-                SETNEXT(heap_p, 0);
-        }
-		
-}
+#ifdef TREE_FIT
+	if (IN_TREE(asize))
+		return tree_fit(asize);
+#endif
 
-/* inserts a free block at the front of the list -- checks
- * if there's nothing already at the front of the list! */
-static void insert_front_list(void *bp)
-{
-	if (NEXT(heap_p))
+	/* the request's own class may already hold a fit */
+	mapping(asize, &fl, &sl);
+	if (fit_policy != MM_FIT_GOOD)
 	{
-		char *orig_first = NEXT(heap_p);
-		SETNEXT(bp, orig_first);
-		SETPREV(orig_first, bp);
+		if ((bp = list_fit(fl*SL_COUNT + sl, asize)) != NULL)
+			return bp;
 	}
 	else
 	{
-		SETNEXT(bp, 0);
+		bp = ROOT(fl*SL_COUNT + sl);
+		STAT_ADD(fit_steps, bp != NULL);
+		if (bp != NULL && asize <= GET_SIZE(HDRP(bp)))
+			return bp;
 	}
-	SETNEXT(heap_p, bp);
-	SETPREV(bp, 0);
+
+	if (asize >= (1 << SMALL_LOG2))
+		mapping(asize + (1 << (FLS(asize) - SL_LOG2)) - 1, &fl, &sl);
+
+	/* non-empty classes above sl in this first level class... */
+	sl_map = SL_BITMAP(fl) & (~0U << sl);
+	if (!sl_map)
+	{
+		/* ... or else the first non-empty larger first level class */
+		fl_map = (fl + 1 < FL_COUNT) ? FL_BITMAP & (~0U << (fl + 1)) : 0;
+		if (!fl_map)
+#ifdef TREE_FIT
+			return seg_classes > 1 ? tree_fit(asize) : NULL;
+#else
+			return NULL;
+#endif
+		fl = FFS(fl_map);
+		sl_map = SL_BITMAP(fl);
+	}
+	sl = FFS(sl_map);
+
+	if (fl*SL_COUNT + sl == NUM_CLASSES - 1 || fit_policy == MM_FIT_BEST)
+		return list_fit(fl*SL_COUNT + sl, asize);
+	STAT_ADD(fit_steps, 1);
+	return ROOT(fl*SL_COUNT + sl);
 }
 
 /*
-static int mm_check(void)
+ * list_fit - searches the list of class i for a block of asize bytes
+ *     by the MM_FIT policy: the first one that fits (good and first
+ *     fit), the first one from where the last search of the list left
+ *     off (next fit), or the smallest one (best fit)
+ */
+static void *list_fit(int i, size_t asize)
 {
-//	printf("-- mm_check \n");
-	int success = 1;
-	size_t heapsize = mem_heapsize();
-	void *mem_lo = mem_heap_lo();
-	void *mem_hi = mem_heap_hi();
-	void *bp;
+	char *bp, *best = NULL;
+	size_t size;
 
-	for (bp = heap_p; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+	switch (fit_policy)
 	{
-		if (GET(HDRP(bp)) != GET(FTRP(bp)))
-		{
-			printf("HEADER AND FOOTERS NOT EQUAL \n");
-			printf("Header: %p \n", (void *)HDRP(bp));
-			printf("Footer: %p \n", (void *)FTRP(bp));
-			success = 0;
-		}
-		if (((int)bp % DSIZE) != 0)
+	case MM_FIT_NEXT:
+		/* from the rover to the end, then from the root up to it */
+		for (bp = arena->rover[i]; bp != NULL; bp = NEXT(bp))
 		{
-			printf("BLOCK NOT ALIGNED PROPERLY \n");
-			printf("%p", bp);
-			success = 0;
+			STAT_ADD(fit_steps, 1);
+			if (asize <= GET_SIZE(HDRP(bp)))
+				return arena->rover[i] = bp;
 		}
-		if (GET_ALLOC(HDRP(bp)) == 0 &&
-			 GET_ALLOC(HDRP(NEXT_BLKP(bp))) == 0)
+		for (bp = ROOT(i); bp != arena->rover[i]; bp = NEXT(bp))
 		{
-			printf("TWO ADJACENT FREE BLOCKS");
-			success = 0;
+			STAT_ADD(fit_steps, 1);
+			if (asize <= GET_SIZE(HDRP(bp)))
+				return arena->rover[i] = bp;
 		}
-		if ((GET_ALLOC(HDRP(bp))) == 0)  //if it's a free block
+		return NULL;
+
+	case MM_FIT_BEST:
+		/* an exact fit ends the search early */
+		for (bp = ROOT(i); bp != NULL; bp = NEXT(bp))
 		{
-			if ((NEXT(bp) != 0) &&
-				 (int *)NEXT(bp) < (int *) mem_lo)
-			{
-				printf("bp's NEXT ADDRESS TOO LOW \n");
-				success = 0;
-			}
-			if ((NEXT(bp) != 0) &&
-				(int *) NEXT(bp) > (int *) mem_hi)
-			{
-				printf("bp's NEXT ADDRESS TOO HIGH \n");
-				success = 0;
-			}
-			if ((PREV(bp) != 0) &&
-				 (int *)PREV(bp) < (int *) mem_lo)
+			STAT_ADD(fit_steps, 1);
+			size = GET_SIZE(HDRP(bp));
+			if (asize <= size &&
+			    (best == NULL || size < GET_SIZE(HDRP(best))))
 			{
-				printf("bp's PREV ADDRESS TOO LOW %p,
-					 %p\n", bp, PREV(bp));
-				success = 0;
-			}
-			if ((PREV(bp) != 0) &&
-				 (int *)PREV(bp) > (int *) mem_hi)
-			{
-				printf("bp's PREV ADDRESS TOO HIGH \n");
-				success = 0;
+				best = bp;
+				if (size == asize)
+					break;
 			}
-		}	
-	}
+		}
+		return best;
 
-	if (!success)
-	{
-		bp = heap_p;
-	        printf("HEAP STARTS AT %p \n", (void *)heap_p);
-	        printf("HEAP SIZE: %zu bytes \n", heapsize);
-	        printf("mem_lo = %p \n", mem_lo);
-	        printf("mem_hi = %p \n", mem_hi);
-	
-	        printf("BLK DATA OF heap_p: \n");
-	        printf("heap_p points to: %p \n", NEXT(heap_p));
-	        block_data(heap_p);
-	        printf("\n");
-		
-		for (bp = heap_p; GET_SIZE(HDRP(bp)) > 0;
-						 bp = NEXT_BLKP(bp))
+	default:
+		for (bp = ROOT(i); bp != NULL; bp = NEXT(bp))
 		{
-			block_data(bp);
+			STAT_ADD(fit_steps, 1);
+			if (asize <= GET_SIZE(HDRP(bp)))
+				return bp;
 		}
+		return NULL;
 	}
-	return success;
-	printf("@@@@@@@@@@@ \n");
 }
 
-static void block_data(void *bp)
+/*
+ * mm_free - Freeing with LIFO policy
+ */
+void mm_free(void *bp)
 {
-	printf("-- Block data \n");
-	int hsize, halloc, fsize, falloc;
-	hsize = GET_SIZE(HDRP(bp));
-	halloc = GET_ALLOC(HDRP(bp));
-	fsize = GET_SIZE(FTRP(bp));
-	falloc = GET_ALLOC(FTRP(bp));
-	if (hsize == 0)
+	if (bp == NULL)		/* like free(NULL), a no-op */
+		return;
+	if (!IN_HEAP(bp))
+		mem_unmap((char *)bp - MAP_OVERHEAD, MAP_LEN(bp));
+	else if (IS_SLAB(bp))
+		slab_free(bp);
+	else
 	{
-		printf("EPILOGUE BLOCK");
+		LOCK(ARENA_OF(bp));
+		free_block(bp);
+		UNLOCK();
 	}
-	if (halloc)
+	CHECKHEAP();
+}
+
+/*
+ * mm_free_sized - mm_free for a block the caller knows was last
+ *     allocated or reallocated with size bytes. Every live block of a
+ *     slab size is a slab object and no slab object is bigger, so the
+ *     size alone picks the path and the slab map is never consulted.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+	if (bp == NULL)
+		return;
+#ifdef DEBUG
+	if (!IN_HEAP(bp) ? size + MAP_OVERHEAD > MAP_LEN(bp) :
+	    IS_SLAB(bp) ? size > slab_max ||
+			  SLAB_CLASS(size) != SLAB_OF(bp)->cls :
+	    size <= slab_max || size + WSIZE > GET_SIZE(HDRP(bp)))
 	{
-		printf("ALLOCATED BLOCK: %p \n", (void *)bp);
-		printf("Size: %i bytes \n", hsize);
-		
+		printf("FREE OF %p WITH WRONG SIZE %lu \n", bp,
+		       (unsigned long)size);
+		mm_free(bp);
+		return;
 	}
+#endif
+	if (size <= slab_max)
+		slab_free(bp);
+	else if (!IN_HEAP(bp))
+		mem_unmap((char *)bp - MAP_OVERHEAD, MAP_LEN(bp));
 	else
 	{
-		printf("FREE BLOCK: %p \n", (void *)bp);
-		printf("Size: %i bytes \n", hsize);
-		printf("Next: %p \n", (void *)(NEXT(bp)));
-		printf("Prev: %p \n", (void *)(PREV(bp)));
+		LOCK(ARENA_OF(bp));
+		free_block(bp);
+		UNLOCK();
 	}
-	printf("@@@@@@@@@@ \n");
+	CHECKHEAP();
 }
-*/
-
-
-
 
+/*
+ * mm_free_batch - frees the n blocks in ptrs, sorting ptrs by address
+ *     first. Slab objects and mapped blocks go one by one; the heap
+ *     blocks of an arena then go under one lock, and those that sit
+ *     right after one another become one block before they are freed,
+ *     so each run of them costs a single coalesce and list update.
+ */
+void mm_free_batch(void **ptrs, int n)
+{
+	arena_t *a;
+	char *bp;
+	size_t size;
+	int i, j, m = 0;
 
+	/* keep just the heap blocks, still in address order */
+	sort_ptrs(ptrs, n);
+	for (i = 0; i < n; i++)
+	{
+		bp = ptrs[i];
+		if (bp == NULL)
+			continue;
+		if (!IN_HEAP(bp))
+			mem_unmap(bp - MAP_OVERHEAD, MAP_LEN(bp));
+		else if (IS_SLAB(bp))
+			slab_free(bp);
+		else
+			ptrs[m++] = bp;
+	}
 
+	for (i = 0; i < m; )
+	{
+		a = ARENA_OF(ptrs[i]);
+		LOCK(a);
+		while (i < m && ARENA_OF(ptrs[i]) == a)
+		{
+			/* take in the allocated neighbors that are freed too */
+			bp = ptrs[i];
+			size = GET_SIZE(HDRP(bp));
+			for (j = i + 1; j < m && (char *)ptrs[j] == bp + size; j++)
+				size += GET_SIZE(HDRP(ptrs[j]));
+			PUT(HDRP(bp), PACK(size, 1 | GET_PREV_ALLOC(HDRP(bp))));
+			free_block(bp);
+			i = j;
+		}
+		UNLOCK();
+	}
+	CHECKHEAP();
+}
+
+/* sort_ptrs - insertion sort of n pointers by address; batches are short */
+static void sort_ptrs(void **ptrs, int n)
+{
+	void *p;
+	int i, j;
+
+	for (i = 1; i < n; i++)
+	{
+		p = ptrs[i];
+		for (j = i; j > 0 && (char *)ptrs[j-1] > (char *)p; j--)
+			ptrs[j] = ptrs[j-1];
+		ptrs[j] = p;
+	}
+}
+
+/* free_block - returns an ordinary block to the free lists, or puts it
+ * on its quick list, where it stays allocated as far as its neighbours
+ * can tell */
+static void free_block(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+	if (size > quick_max)
+	{
+		merge_block(bp);
+		return;
+	}
+	PUT(HDRP(bp), PACK(size, 1 | GET_PREV_ALLOC(HDRP(bp))));
+	SETNEXT(bp, QUICK(size));
+	QUICK(size) = bp;
+	arena->quick_bytes += size;
+	if (++arena->nquick >= QUICK_LIMIT)
+		quick_flush();
+}
+
+/* quick_flush - frees every block of the current arena's quick lists
+ * for real, merging each with its free neighbours */
+static void quick_flush(void)
+{
+	char *bp, *next;
+	int i;
+
+	STAT_ADD(quick_flushes, 1);
+	for (i = 0; i < QUICK_LISTS; i++)
+	{
+		/* a merge never reaches into a block still on a quick list */
+		for (bp = arena->quick[i]; bp != NULL; bp = next)
+		{
+			next = NEXT(bp);
+			merge_block(bp);
+		}
+		arena->quick[i] = NULL;
+	}
+	arena->nquick = 0;
+	arena->quick_bytes = 0;
+}
+
+/* merge_block - returns an ordinary block to the free lists, merged
+ * with the free blocks around it. A neighbour that was big enough to
+ * release has had its pages released already, so only the rest of the
+ * merged block is released now. */
+static void merge_block(void *bp)
+{
+	/* size should be double word aligned */
+	size_t size = GET_SIZE(HDRP(bp));	
+	char *next = NEXT_BLKP(bp);
+	char *lo, *hi;
+	int prev_big, next_big;
+
+	prev_big = !GET_PREV_ALLOC(HDRP(bp)) &&
+		   GET_SIZE(HDRP(PREV_BLKP(bp))) >= trim_min;
+	next_big = !GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(next)) >= trim_min;
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), PACK(size, 0));
+	CLR_PREV_ALLOC(HDRP(next));
+	lo = (char *)bp - DSIZE;	/* the footer in front, if it merges */
+	bp = coalesce(bp);
+	if (trim_min && GET_SIZE(HDRP(bp)) >= trim_min)
+	{
+		if (!prev_big)
+			lo = (char *)bp;
+		hi = next_big ? next + MIN_BLKSIZE : FTRP(bp);
+		release_block(bp, lo, hi);
+	}
+}
+
+/*
+ * release_block - gives the memory of a big free block back to memlib.
+ *     The last block of the heap shrinks to the growth step and the heap
+ *     with it. Any other block keeps only its header, links and footer;
+ *     memlib may drop the pages in between that lie in [lo, hi), the
+ *     part of the block not released before.
+ */
+static void release_block(void *bp, char *lo, char *hi)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	size_t keep = ALIGN(arena->chunk);
+	size_t trim, step;
+
+	if (GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+	{
+		lo = MAX(lo, (char *)bp + MIN_BLKSIZE);
+		hi = MIN(hi, FTRP(bp));
+		if (hi > lo)
+			mem_release(lo, hi - lo);
+		return;
+	}
+	if (size < keep + MIN_BLKSIZE)
+		return;
+
+	/* the epilogue moves down to the end of the kept part, and the
+	 * break with it, in steps an int increment can take */
+	rmv_from_list(bp);
+	PUT(HDRP(bp), PACK(keep, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(keep, 0));
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
+	for (trim = size - keep; trim > 0; trim -= step)
+	{
+		step = trim < SBRK_MAX ? trim : SBRK_MAX;
+		mem_sbrk_arena(arena->id, -(int)step);
+	}
+	insert_front_list(bp);
+}
+
+/*
+ * mm_region_create - returns a new, empty region, or NULL
+ */
+mm_region_t *mm_region_create(void)
+{
+	mm_region_t *r;
+
+	if ((r = mm_malloc(sizeof(mm_region_t))) == NULL)
+		return NULL;
+	r->chunk = r->bump = r->end = NULL;
+	r->next_size = REGION_MIN;
+	return r;
+}
+
+/*
+ * mm_region_alloc - bump-allocates size bytes from region r. Objects
+ *     have no header; a request the chunk cannot hold starts a new
+ *     chunk, twice the size of the last up to REGION_MAX, or as big as
+ *     the request needs.
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+	size_t csize;
+	char *c, *bp;
+
+	size = ALIGN(MAX(size, 1));
+	if ((size_t)(r->end - r->bump) < size)
+	{
+		csize = MAX(r->next_size, ALIGN(PSIZE) + size);
+		if ((c = mm_malloc(csize)) == NULL)
+			return NULL;
+		CHUNK_PREV(c) = r->chunk;
+		r->chunk = c;
+		r->bump = c + ALIGN(PSIZE);
+		r->end = c + csize;
+		r->next_size = MIN(2 * r->next_size, REGION_MAX);
+	}
+	bp = r->bump;
+	r->bump += size;
+	return bp;
+}
+
+/*
+ * mm_region_reset - frees every object of region r at once. All its
+ *     chunks but the newest, which is the biggest, are freed; that one
+ *     is bump-allocated from the start again.
+ */
+void mm_region_reset(mm_region_t *r)
+{
+	char *c, *prev;
+
+	if (r->chunk == NULL)
+		return;
+	for (c = CHUNK_PREV(r->chunk); c != NULL; c = prev)
+	{
+		prev = CHUNK_PREV(c);
+		mm_free(c);
+	}
+	CHUNK_PREV(r->chunk) = NULL;
+	r->bump = r->chunk + ALIGN(PSIZE);
+}
+
+/*
+ * mm_region_destroy - frees region r with all its objects and chunks
+ */
+void mm_region_destroy(mm_region_t *r)
+{
+	char *c, *prev;
+
+	for (c = r->chunk; c != NULL; c = prev)
+	{
+		prev = CHUNK_PREV(c);
+		mm_free(c);
+	}
+	mm_free(r);
+}
+
+/*
+ * map_alloc - serves a huge request from a region of its own, which
+ *     mm_free hands straight back to the OS
+ */
+static void *map_alloc(size_t size)
+{
+	size_t len = MAP_LENGTH(size);
+	char *bp;
+
+	if ((bp = mem_map(len)) == NULL)
+		return NULL;
+	bp += MAP_OVERHEAD;
+	MAP_LEN(bp) = len;
+	return bp;
+}
+
+/*
+ * map_realloc - resizes a mapped block by remapping its region, which
+ *     moves the pages rather than copying the data
+ */
+static void *map_realloc(void *bp, size_t size)
+{
+	size_t len = MAP_LENGTH(size);
+	char *p;
+
+	if (len != MAP_LEN(bp))
+	{
+		p = mem_remap((char *)bp - MAP_OVERHEAD, MAP_LEN(bp), len);
+		if (p == NULL)
+			return NULL;
+		bp = p + MAP_OVERHEAD;
+		MAP_LEN(bp) = len;
+	}
+	__atomic_add_fetch(&mm_copies_avoided, 1, __ATOMIC_RELAXED);
+	return bp;
+}
+
+/*
+ * mm_realloc - resizes the block in place when it can: shrinking it,
+ *     growing it into a free next block or the heap tail, or sliding it
+ *     down into a free previous block. Otherwise it falls back to
+ *     mm_malloc, memcpy and mm_free.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    void *oldptr = ptr;
+    void *newptr;
+    size_t copySize;
+    size_t asize, csize, nsize, psize;
+    size_t want, newsize = size;
+    unsigned int tag = REALLOC_TAG;
+    char *next, *prev;
+
+    if (oldptr == NULL)
+      return mm_malloc(size);
+    if (size == 0)
+    {
+      mm_free(oldptr);
+      return NULL;
+    }
+
+    /* a mapped block is remapped unless it now fits a slab: any block
+     * of a slab size is a slab object, which mm_free_sized counts on */
+    if (!IN_HEAP(oldptr))
+    {
+      if (size > slab_max)
+	return map_realloc(oldptr, size);
+      copySize = MAP_LEN(oldptr) - MAP_OVERHEAD;
+    }
+
+    /* a slab object stays put while the new size maps to its class */
+    else if (IS_SLAB(oldptr))
+    {
+      if (size <= slab_max && SLAB_CLASS(size) == SLAB_OF(oldptr)->cls)
+      {
+	__atomic_add_fetch(&mm_copies_avoided, 1, __ATOMIC_RELAXED);
+	return oldptr;
+      }
+      copySize = SLAB_SLOT(SLAB_OF(oldptr)->cls);
+    }
+
+    /* a heap block shrunk to a slab size moves into a slab too */
+    else if (size <= slab_max)
+    {
+      LOCK(ARENA_OF(oldptr));
+      copySize = GET_SIZE(HDRP(oldptr)) - WSIZE;
+      UNLOCK();
+    }
+    else
+    {
+      LOCK(ARENA_OF(oldptr));
+
+      /* the block, and the free block behind it if there is one */
+      asize = MAX(ALIGN(size + WSIZE), MIN_BLKSIZE);
+      csize = GET_SIZE(HDRP(oldptr));
+      next = NEXT_BLKP(oldptr);
+      nsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+
+      /* a block grown before gets half as much again as headroom, so
+       * the grows after it only rewrite the header; the headroom stays
+       * until the block is freed or asked to shrink below half of it */
+      want = asize;
+      if (asize > csize && GET_TAG(HDRP(oldptr)))
+      {
+	want = ALIGN(asize + asize / 2);
+	newsize = want - WSIZE;
+      }
+      else if (asize <= csize)
+      {
+	if (GET_TAG(HDRP(oldptr)) && asize > csize / 2)
+	{
+	  UNLOCK();
+	  __atomic_add_fetch(&mm_copies_avoided, 1, __ATOMIC_RELAXED);
+	  return oldptr;
+	}
+	tag = 0;
+      }
+
+      /* at the end of the heap, grow it by just the missing bytes, or
+       * without the headroom if memlib is short of them; if it is out
+       * of even those, the block in front may still do */
+      if (csize + nsize < want &&
+	  GET_SIZE(HDRP(nsize ? NEXT_BLKP(next) : next)) == 0 &&
+	  (extend_heap((want - csize - nsize) / WSIZE) != NULL ||
+	   (csize + nsize < asize &&
+	    extend_heap((asize - csize - nsize) / WSIZE) != NULL)))
+	nsize = GET_SIZE(HDRP(next));
+
+      /* shrink, or grow into the next block, without moving */
+      if (csize + nsize >= asize)
+      {
+	if (nsize)
+	  rmv_from_list(next);
+	csize += nsize;
+	PUT(HDRP(oldptr), PACK(csize, 1 | GET_PREV_ALLOC(HDRP(oldptr)) | tag));
+	SET_PREV_ALLOC(HDRP(NEXT_BLKP(oldptr)));
+	shrink_block(oldptr, MIN(want, csize));
+	UNLOCK();
+	__atomic_add_fetch(&mm_copies_avoided, 1, __ATOMIC_RELAXED);
+	CHECKHEAP();
+	return oldptr;
+      }
+
+      /* take in the free block in front too, sliding the data down */
+      if (!GET_PREV_ALLOC(HDRP(oldptr)))
+      {
+	prev = PREV_BLKP(oldptr);
+	psize = GET_SIZE(HDRP(prev));
+	if (psize + csize + nsize >= asize)
+	{
+	  rmv_from_list(prev);
+	  if (nsize)
+	    rmv_from_list(next);
+	  memmove(prev, oldptr, MIN(csize - WSIZE, size));
+	  csize += psize + nsize;
+	  PUT(HDRP(prev), PACK(csize, 1 | PREV_ALLOC | tag));
+	  SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+	  shrink_block(prev, MIN(want, csize));
+	  UNLOCK();
+	  CHECKHEAP();
+	  return prev;
+	}
+      }
+
+      copySize = csize - WSIZE; /* old payload */
+      UNLOCK();
+    }
+
+    /* the headroom is only worth having while there is room for it */
+    newptr = mm_malloc(newsize);
+    if (newptr == NULL && newsize > size)
+      newptr = mm_malloc(size);
+    if (newptr == NULL)
+      return NULL;
+    if (IN_HEAP(newptr) && !IS_SLAB(newptr))
+    {
+      LOCK(ARENA_OF(newptr));
+      PUT(HDRP(newptr), GET(HDRP(newptr)) | REALLOC_TAG);
+      UNLOCK();
+    }
+
+    if (size < copySize)
+      copySize = size;
+
+    memcpy(newptr, oldptr, copySize);
+    mm_free(oldptr);
+    return newptr;
+	
+}
+
+/*
+ * shrink_block - cuts allocated block bp down to asize bytes, freeing
+ *     the rest if it is big enough to be a block of its own
+ */
+static void shrink_block(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if (csize - asize >= split_min)
+	{
+		STAT_ADD(splits, 1);
+		PUT(HDRP(bp), PACK(asize, GET(HDRP(bp)) & 0x7));
+		PUT(HDRP(NEXT_BLKP(bp)), PACK(csize - asize, 1 | PREV_ALLOC));
+		free_block(NEXT_BLKP(bp));
+	}
+}
+
+/*
+ * mapping - splits a block size into its first and second level class;
+ *     sizes past the last class are clamped into it
+ */
+static void mapping(size_t size, int *fl, int *sl)
+{
+	int l;
+
+	if (size < (1 << SMALL_LOG2))
+	{
+		*fl = 0;
+		*sl = size >> 3;
+		return;
+	}
+	l = FLS(size);
+	*fl = l - SMALL_LOG2 + 1;
+	*sl = (size >> (l - SL_LOG2)) ^ SL_COUNT;
+	if (*fl >= FL_COUNT)
+	{
+		*fl = FL_COUNT - 1;
+		*sl = SL_COUNT - 1;
+	}
+}
+
+/*
+ * size_class - returns the class list a free block of size bytes
+ *     belongs on
+ */
+static int size_class(size_t size)
+{
+	int fl, sl;
+
+	if (seg_classes == 1)
+		return 0;
+	mapping(size, &fl, &sl);
+	return fl*SL_COUNT + sl;
+}
+
+/* removes a free block from its class list -- the header must still
+ * hold the size the block was inserted with */
+static void rmv_from_list(void *bp)
+{
+	char *orig_prev = PREV(bp);
+	char *orig_next = NEXT(bp);
+
+	int i;
+
+	arena->free_bytes -= GET_SIZE(HDRP(bp));
+	STAT_ADD(nfree[stat_class(GET_SIZE(HDRP(bp)))], -1);
+#ifdef TREE_FIT
+	if (IN_TREE(GET_SIZE(HDRP(bp))))
+	{
+		tree_remove(bp);
+		return;
+	}
+#endif
+
+	/* a next fit search resumes after the block */
+	if (fit_policy == MM_FIT_NEXT)
+	{
+		i = size_class(GET_SIZE(HDRP(bp)));
+		if (arena->rover[i] == bp)
+			arena->rover[i] = orig_next;
+	}
+
+	if (orig_prev)
+		SETNEXT(orig_prev, orig_next);
+	else /* first block, the class root moves on */
+	{
+		i = size_class(GET_SIZE(HDRP(bp)));
+		ROOT(i) = orig_next;
+
+		/* class went empty, clear its bits */
+		if (!orig_next)
+		{
+			SL_BITMAP(i / SL_COUNT) &= ~(1U << (i % SL_COUNT));
+			if (!SL_BITMAP(i / SL_COUNT))
+				FL_BITMAP &= ~(1U << (i / SL_COUNT));
+		}
+	}
+
+	if (orig_next)
+		SETPREV(orig_next, orig_prev);
+}
+
+/* inserts a free block at the front of its class list -- checks
+ * if there's nothing already at the front of the list! With
+ * MM_ORDER_ADDR it goes in after the last block below it instead. */
+static void insert_front_list(void *bp)
+{
+	int i = size_class(GET_SIZE(HDRP(bp)));
+	char *orig_first = ROOT(i);
+	char *prev;
+
+	arena->free_bytes += GET_SIZE(HDRP(bp));
+	STAT_ADD(nfree[stat_class(GET_SIZE(HDRP(bp)))], 1);
+#ifdef TREE_FIT
+	if (IN_TREE(GET_SIZE(HDRP(bp))))
+	{
+		tree_insert(bp);
+		return;
+	}
+#endif
+
+	if (addr_order && orig_first && orig_first < (char *)bp)
+	{
+		for (prev = orig_first; NEXT(prev) && NEXT(prev) < (char *)bp;
+		     prev = NEXT(prev))
+			;
+		SETNEXT(bp, NEXT(prev));
+		SETPREV(bp, prev);
+		if (NEXT(prev))
+			SETPREV(NEXT(prev), bp);
+		SETNEXT(prev, bp);
+		return;
+	}
+
+	if (orig_first)
+		SETPREV(orig_first, bp);
+	SETNEXT(bp, orig_first);
+	SETPREV(bp, 0);
+	ROOT(i) = bp;
+	SL_BITMAP(i / SL_COUNT) |= 1U << (i % SL_COUNT);
+	FL_BITMAP |= 1U << (i / SL_COUNT);
+}
+
+#ifdef MM_STATS
+/* stat_class - the size class of a free block for mm_stats, which is
+ *     its two level class even with a single list or in the tree */
+static int stat_class(size_t size)
+{
+	int fl, sl;
+
+	mapping(size, &fl, &sl);
+	return fl*SL_COUNT + sl;
+}
+
+/* largest_free - the biggest free block of the current arena: in the
+ *     highest non-empty class, or at the right end of the tree */
+static size_t largest_free(void)
+{
+	size_t max = 0;
+	char *bp;
+	int fl, i = 0;
+
+	if (seg_classes > 1 && FL_BITMAP)
+	{
+		fl = FLS(FL_BITMAP);
+		i = fl*SL_COUNT + FLS(SL_BITMAP(fl));
+	}
+	for (bp = ROOT(i); bp != NULL; bp = NEXT(bp))
+		max = MAX(max, GET_SIZE(HDRP(bp)));
+#ifdef TREE_FIT
+	for (bp = arena->tree_root; bp != NULL; bp = RIGHT(bp))
+		max = MAX(max, GET_SIZE(HDRP(bp)));
+#endif
+	return max;
+}
+#endif
+
+/*
+ * mm_stats - fills in *st from the counters of every arena and the
+ *     current heap; returns 0, leaving *st alone, without -DMM_STATS.
+ *     Slab pages count as live only for the slots handed out.
+ */
+int mm_stats(mm_stats_t *st)
+{
+#ifdef MM_STATS
+	size_t idle = 0, p, end;
+	slab_t *s;
+	int i, j;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < narenas; i++)
+	{
+		LOCK(&arenas[i]);
+		st->free_bytes += arena->free_bytes + arena->quick_bytes;
+		st->largest_free = MAX(st->largest_free, largest_free());
+		for (j = 0; j < NUM_CLASSES; j++)
+			st->free_blocks[j] += arena->st.nfree[j];
+		st->sbrks += arena->st.sbrks;
+		st->splits += arena->st.splits;
+		st->merges += arena->st.merges;
+		st->fits += arena->st.fits;
+		st->fit_steps += arena->st.fit_steps;
+		st->quick_hits += arena->st.quick_hits;
+		st->quick_flushes += arena->st.quick_flushes;
+
+		/* the unused part of each slab page of the arena, which
+		 * cannot go back to the heap while we hold its lock */
+		p = ((char *)mem_arena_lo(i) - heap_lo) / SLAB_SIZE;
+		end = MIN(p + arena_span / SLAB_SIZE, arena->slab_top * 8);
+		for (; p < end; p++)
+		{
+			s = (slab_t *)(heap_lo + p * SLAB_SIZE);
+			if (IS_SLAB(s))
+				idle += GET_SIZE(HDRP(s)) -
+					s->used * SLAB_SLOT(s->cls);
+		}
+		idle += PROLOGUE_PAD + PROLOGUE_SIZE + WSIZE;
+		UNLOCK();
+	}
+
+	/* memlib's total includes the mapped regions */
+	st->live_bytes = mem_heapsize() - st->free_bytes - idle;
+	if (st->free_bytes)
+		st->fragmentation = 1 - (double)st->largest_free / st->free_bytes;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+#ifdef TREE_FIT
+/*
+ * tree_cmp - orders the key (size, bp) against tree block t
+ */
+static int tree_cmp(size_t size, char *bp, char *t)
+{
+	size_t tsize = GET_SIZE(HDRP(t));
+
+	if (size != tsize)
+		return size < tsize ? -1 : 1;
+	if (bp != t)
+		return bp < t ? -1 : 1;
+	return 0;
+}
+
+/*
+ * splay - top-down splay of tree t on the key (size, bp). The block with
+ *     that key, or else the one just before or after it, ends up at the
+ *     returned root.
+ */
+static char *splay(char *t, size_t size, char *bp)
+{
+	char *n[2], *l, *r, *y;
+
+	if (t == NULL)
+		return NULL;
+	LEFT(n) = RIGHT(n) = NULL;
+	l = r = (char *)n;
 
+	for (;;)
+	{
+		if (tree_cmp(size, bp, t) < 0)
+		{
+			if (LEFT(t) == NULL)
+				break;
+			if (tree_cmp(size, bp, LEFT(t)) < 0)
+			{
+				/* rotate right */
+				y = LEFT(t);
+				LEFT(t) = RIGHT(y);
+				RIGHT(y) = t;
+				t = y;
+				if (LEFT(t) == NULL)
+					break;
+			}
+			/* link right */
+			LEFT(r) = t;
+			r = t;
+			t = LEFT(t);
+		}
+		else if (tree_cmp(size, bp, t) > 0)
+		{
+			if (RIGHT(t) == NULL)
+				break;
+			if (tree_cmp(size, bp, RIGHT(t)) > 0)
+			{
+				/* rotate left */
+				y = RIGHT(t);
+				RIGHT(t) = LEFT(y);
+				LEFT(y) = t;
+				t = y;
+				if (RIGHT(t) == NULL)
+					break;
+			}
+			/* link left */
+			RIGHT(l) = t;
+			l = t;
+			t = RIGHT(t);
+		}
+		else
+			break;
+	}
+
+	/* assemble */
+	RIGHT(l) = LEFT(t);
+	LEFT(r) = RIGHT(t);
+	LEFT(t) = RIGHT(n);
+	RIGHT(t) = LEFT(n);
+	return t;
+}
+
+/* tree_insert - adds free block bp to the tree, as its new root */
+static void tree_insert(void *bp)
+{
+	char *t = splay(arena->tree_root, GET_SIZE(HDRP(bp)), bp);
+
+	if (t == NULL)
+		LEFT(bp) = RIGHT(bp) = NULL;
+	else if (tree_cmp(GET_SIZE(HDRP(bp)), bp, t) < 0)
+	{
+		LEFT(bp) = LEFT(t);
+		RIGHT(bp) = t;
+		LEFT(t) = NULL;
+	}
+	else
+	{
+		RIGHT(bp) = RIGHT(t);
+		LEFT(bp) = t;
+		RIGHT(t) = NULL;
+	}
+	arena->tree_root = bp;
+}
+
+/* tree_remove - takes free block bp out of the tree */
+static void tree_remove(void *bp)
+{
+	char *t = splay(arena->tree_root, GET_SIZE(HDRP(bp)), bp);
+
+	/* bp is the root now; its largest left descendant replaces it */
+	if (LEFT(t) == NULL)
+		arena->tree_root = RIGHT(t);
+	else
+	{
+		arena->tree_root = splay(LEFT(t), GET_SIZE(HDRP(bp)), bp);
+		RIGHT(arena->tree_root) = RIGHT(t);
+	}
+}
+
+/*
+ * tree_fit - the smallest tree block of at least asize bytes, lowest
+ *     address first among equals, or NULL
+ */
+static void *tree_fit(size_t asize)
+{
+	char *t;
+
+	if ((t = arena->tree_root = splay(arena->tree_root, asize, NULL))
+	    == NULL)
+		return NULL;
+	if (GET_SIZE(HDRP(t)) >= asize)
+		return t;
+
+	/* the root is the block just before the key, so take the least
+	 * block after it */
+	if ((t = RIGHT(t)) == NULL)
+		return NULL;
+	while (LEFT(t) != NULL)
+		t = LEFT(t);
+	return t;
+}
+#endif
+
+/*
+ * slab_alloc - hands out a slot of the request's slab class from the
+ *     calling thread's slabs, recycling freed slots before bumping into
+ *     fresh ones. Only a new slab takes the heap lock.
+ */
+static void *slab_alloc(size_t size)
+{
+	int cls = SLAB_CLASS(size);
+	tcache_t *tc;
+	slab_t *s;
+	char *bp;
+
+	if ((tc = my_tcache()) == NULL)
+		return NULL;
+
+	/* slots other threads gave back come in before a new slab */
+	if ((s = tc->partial[cls]) == NULL &&
+	    __atomic_load_n(&tc->pending, __ATOMIC_RELAXED) != NULL)
+	{
+		slab_drain(tc);
+		s = tc->partial[cls];
+	}
+	if (s == NULL)
+	{
+		LOCK(tc->arena);
+		s = slab_new(tc, cls);
+		UNLOCK();
+		if (s == NULL)
+			return NULL;
+	}
+
+	if (s->free)
+	{
+		bp = s->free;
+		s->free = NEXT(bp);
+	}
+	else
+	{
+		bp = s->bump;
+		s->bump += SLAB_SLOT(cls);
+	}
+
+	/* full slabs leave the class list until a slot comes back */
+	if (++s->used == s->slots)
+		slab_unlink(s);
+	return bp;
+}
+
+/*
+ * slab_free - puts a slot back on its slab; an empty slab goes back
+ *     to the heap unless it is the last one of its class with room.
+ *     A slot of another thread's slab goes on the slab's remote list,
+ *     and the first one on it hands the slab to its owner's pending
+ *     list, for the owner to take back in one go.
+ */
+static void slab_free(void *bp)
+{
+	slab_t *s = SLAB_OF(bp);
+	tcache_t *tc = s->owner;
+	char *head;
+	slab_t *first;
+
+	if (tc != tcache || tcache_gen != heap_gen)
+	{
+		head = __atomic_load_n(&s->remote, __ATOMIC_RELAXED);
+		do
+			SETNEXT(bp, head);
+		while (!__atomic_compare_exchange_n(&s->remote, &head, bp, 1,
+			__ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+		if (head != NULL)
+			return;
+
+		first = __atomic_load_n(&tc->pending, __ATOMIC_RELAXED);
+		do
+			s->pending = first;
+		while (!__atomic_compare_exchange_n(&tc->pending, &first, s, 1,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		return;
+	}
+
+	SETNEXT(bp, s->free);
+	s->free = bp;
+	if (s->used-- == s->slots)
+		slab_link(s);
+	if (s->used == 0 && (s->next != NULL || s->prev != NULL))
+		slab_release(s);
+}
+
+/*
+ * slab_drain - takes back the slots other threads freed into the slabs
+ *     of cache tc. A slab is drained only after it was taken off the
+ *     pending list, so it cannot go back to the heap while a remote
+ *     free still has to put it on that list.
+ */
+static void slab_drain(tcache_t *tc)
+{
+	slab_t *s, *next;
+	char *bp, *chain;
+	int n;
+
+	s = __atomic_exchange_n(&tc->pending, NULL, __ATOMIC_ACQUIRE);
+	for (; s != NULL; s = next)
+	{
+		/* once remote is empty, another free may push s again */
+		next = s->pending;
+		chain = __atomic_exchange_n(&s->remote, NULL, __ATOMIC_ACQ_REL);
+		for (n = 0, bp = chain; NEXT(bp) != NULL; bp = NEXT(bp))
+			n++;
+		SETNEXT(bp, s->free);
+		s->free = chain;
+		if (s->used == s->slots)
+			slab_link(s);
+		s->used -= n + 1;
+		if (s->used == 0 && (s->next != NULL || s->prev != NULL))
+			slab_release(s);
+	}
+}
+
+/* slab_release - gives the empty slab s back to the heap */
+static void slab_release(slab_t *s)
+{
+	slab_unlink(s);
+	LOCK(ARENA_OF(s));
+	CLR_SLAB(s);
+	free_block(s);
+	UNLOCK();
+}
+
+/*
+ * slab_new - sets up an empty slab of class cls for cache tc in a fresh
+ *     slab page; the caller holds the lock of the cache's arena
+ */
+static slab_t *slab_new(tcache_t *tc, int cls)
+{
+	slab_t *s;
+	char *first;
+
+	if ((s = (slab_t *)slab_page()) == NULL)
+		return NULL;
+
+	/* slots run from after the header to the next block's header */
+	first = (char *)s + ALIGN(sizeof(slab_t));
+	s->free = NULL;
+	s->bump = first;
+	s->owner = tc;
+	s->remote = NULL;
+	s->used = 0;
+	s->slots = (SLAB_SIZE - WSIZE - (first - (char *)s)) / SLAB_SLOT(cls);
+	s->cls = cls;
+
+	SET_SLAB(s);
+	arena->slab_top = MAX(arena->slab_top, (PAGE_IDX(s) >> 3) + 1);
+	slab_link(s);
+	return s;
+}
+
+/*
+ * slab_page - allocates a block whose payload is a SLAB_SIZE page of
+ *     the heap, from a free block that holds one or else from the heap
+ *     tail, growing the heap by no more than the page needs
+ */
+static char *slab_page(void)
+{
+	char *bp, *epi;
+	size_t csize, front, rest;
+
+	if ((bp = find_fit(2*SLAB_SIZE + MIN_BLKSIZE)) == NULL && arena->nquick)
+	{
+		quick_flush();
+		bp = find_fit(2*SLAB_SIZE + MIN_BLKSIZE);
+	}
+	if (bp == NULL)
+	{
+		/* a page where the epilogue is, or in a free tail block */
+		epi = (char *)mem_arena_hi(arena->id) + 1;
+		bp = GET_PREV_ALLOC(HDRP(epi)) ? epi : PREV_BLKP(epi);
+		front = (SLAB_SIZE - PAGE_OFF(bp)) & (SLAB_SIZE-1);
+		if (front != 0 && front < MIN_BLKSIZE)
+			front += SLAB_SIZE;
+		if (bp + front + SLAB_SIZE > epi &&
+		    (bp = extend_heap((bp + front + SLAB_SIZE - epi)/WSIZE))
+		    == NULL)
+			return NULL;
+	}
+
+	/* the part in front of the page stays free */
+	csize = GET_SIZE(HDRP(bp));
+	front = (SLAB_SIZE - PAGE_OFF(bp)) & (SLAB_SIZE-1);
+	if (front != 0 && front < MIN_BLKSIZE)
+		front += SLAB_SIZE;
+	rmv_from_list(bp);
+	if (front)
+	{
+		PUT(HDRP(bp), PACK(front, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(front, 0));
+		insert_front_list(bp);
+		bp += front;
+		PUT(HDRP(bp), PACK(csize - front, 0));
+	}
+
+	/* so does the part behind it, if it can be a block of its own */
+	rest = csize - front - SLAB_SIZE;
+	if (rest >= MIN_BLKSIZE)
+	{
+		PUT(HDRP(bp), PACK(SLAB_SIZE, 1 | GET_PREV_ALLOC(HDRP(bp))));
+		PUT(HDRP(NEXT_BLKP(bp)), PACK(rest, PREV_ALLOC));
+		PUT(FTRP(NEXT_BLKP(bp)), PACK(rest, 0));
+		insert_front_list(NEXT_BLKP(bp));
+	}
+	else
+	{
+		PUT(HDRP(bp), PACK(csize - front, 1 | GET_PREV_ALLOC(HDRP(bp))));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+	}
+	return bp;
+}
+
+/* slab_link - puts slab s at the front of its owner's class list */
+static void slab_link(slab_t *s)
+{
+	s->prev = NULL;
+	s->next = s->owner->partial[s->cls];
+	if (s->next)
+		s->next->prev = s;
+	s->owner->partial[s->cls] = s;
+}
+
+/* slab_unlink - takes slab s off its owner's class list */
+static void slab_unlink(slab_t *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		s->owner->partial[s->cls] = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	s->next = s->prev = NULL;
+}
+
+/* my_tcache - the calling thread's cache, set up on first use */
+static tcache_t *my_tcache(void)
+{
+	return tcache_gen == heap_gen ? tcache : tcache_get();
+}
+
+/*
+ * tcache_get - sets up the calling thread's cache for the current heap,
+ *     taking over the cache of an exited thread if there is one. New
+ *     caches go to the arenas round-robin, and live in their arena.
+ */
+static tcache_t *tcache_get(void)
+{
+	tcache_t *tc;
+	arena_t *a;
+	int i;
+
+	pthread_mutex_lock(&cache_lock);
+	if ((tc = orphans) != NULL)
+		orphans = tc->next;
+	a = &arenas[next_arena];
+	if (tc == NULL)
+		next_arena = (next_arena + 1) % narenas;
+	pthread_mutex_unlock(&cache_lock);
+
+	if (tc == NULL)
+	{
+		LOCK(a);
+		tc = heap_alloc(ALIGN(sizeof(tcache_t) + WSIZE));
+		UNLOCK();
+		if (tc == NULL)
+			return NULL;
+		for (i = 0; i < SLAB_CLASSES; i++)
+			tc->partial[i] = NULL;
+		tc->pending = NULL;
+		tc->arena = a;
+	}
+
+	tcache = tc;
+	tcache_gen = heap_gen;
+	pthread_setspecific(tcache_key, tc);
+	return tc;
+}
+
+/*
+ * mm_once_init - creates the arena locks, and the key whose destructor
+ *     runs at thread exit
+ */
+static void mm_once_init(void)
+{
+	int i;
+
+	for (i = 0; i < MEM_MAX_ARENAS; i++)
+		pthread_mutex_init(&arenas[i].lock, NULL);
+	pthread_key_create(&tcache_key, tcache_exit);
+}
+
+/*
+ * tcache_exit - parks the cache of an exiting thread, slabs and all,
+ *     for the next new thread; a cache of an earlier heap is dropped
+ */
+static void tcache_exit(void *tc)
+{
+	pthread_mutex_lock(&cache_lock);
+	if (tc == tcache && tcache_gen == heap_gen)
+	{
+		((tcache_t *)tc)->next = orphans;
+		orphans = tc;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+#ifdef DEBUG
+/* check_arenas - runs mm_check on every arena, under its lock */
+static void check_arenas(void)
+{
+	int i;
+
+	for (i = 0; i < narenas; i++)
+	{
+		LOCK(&arenas[i]);
+		assert(mm_check());
+		UNLOCK();
+	}
+}
+
+/*
+ * mm_check - walks the heap of the current arena and every class list;
+ *     returns 0 and dumps the heap when an invariant is broken
+ */
+static int mm_check(void)
+{
+	int success = 1;
+	size_t heapsize = mem_arena_size(arena->id);
+	void *mem_lo = mem_arena_lo(arena->id);
+	void *mem_hi = mem_arena_hi(arena->id);
+	void *bp;
+	int i;
+	long heap_free = 0, list_free = 0, quick_free = 0;
+	size_t list_bytes = 0, quick_bytes = 0;
+	int prev_alloc = 1;
+
+	for (bp = NEXT_BLKP(arena->heap_p); GET_SIZE(HDRP(bp)) > 0;
+	     bp = NEXT_BLKP(bp))
+	{
+		if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc)
+		{
+			printf("PREV ALLOCATED BIT WRONG AT %p \n", bp);
+			success = 0;
+		}
+		prev_alloc = GET_ALLOC(HDRP(bp));
+		if (!GET_ALLOC(HDRP(bp)) &&
+		    GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)))
+		{
+			printf("HEADER AND FOOTERS NOT EQUAL \n");
+			printf("Header: %p \n", (void *)HDRP(bp));
+			printf("Footer: %p \n", (void *)FTRP(bp));
+			success = 0;
+		}
+		if (!GET_ALLOC(HDRP(bp)) && GET_TAG(HDRP(bp)))
+		{
+			printf("REALLOC TAG ON FREE BLOCK %p \n", bp);
+			success = 0;
+		}
+		if (((unsigned long)bp % ALIGNMENT) != 0)
+		{
+			printf("BLOCK NOT ALIGNED PROPERLY \n");
+			printf("%p", bp);
+			success = 0;
+		}
+		if (GET_ALLOC(HDRP(bp)) == 0 &&
+			 GET_ALLOC(HDRP(NEXT_BLKP(bp))) == 0)
+		{
+			printf("TWO ADJACENT FREE BLOCKS");
+			success = 0;
+		}
+		if ((GET_ALLOC(HDRP(bp))) == 0)  //if it's a free block
+			heap_free++;
+	}
+	if (!GET_PREV_ALLOC(HDRP(bp)) != !prev_alloc)
+	{
+		printf("EPILOGUE PREV ALLOCATED BIT WRONG \n");
+		success = 0;
+	}
+
+	for (i = 0; i < SLAB_CLASSES && tcache_gen == heap_gen &&
+		    tcache->arena == arena; i++)
+	{
+		slab_t *s;
+		for (s = tcache->partial[i]; s != NULL; s = s->next)
+		{
+			if (!IS_SLAB(s) || PAGE_OFF(s) != 0 ||
+			    !GET_ALLOC(HDRP(s)))
+			{
+				printf("SLAB %p NOT ON AN ALLOCATED PAGE \n", s);
+				success = 0;
+				break;
+			}
+			if (s->cls != i || s->used >= s->slots ||
+			    s->owner != tcache)
+			{
+				printf("SLAB %p ON WRONG LIST %d \n", s, i);
+				success = 0;
+			}
+		}
+	}
+
+	for (i = 0; i < QUICK_LISTS; i++)
+	{
+		for (bp = arena->quick[i]; bp != NULL; bp = NEXT(bp))
+		{
+			quick_free++;
+			quick_bytes += GET_SIZE(HDRP(bp));
+			if (!GET_ALLOC(HDRP(bp)) ||
+			    GET_SIZE(HDRP(bp)) / ALIGNMENT != (size_t)i)
+			{
+				printf("BLOCK %p ON QUICK LIST %d \n", bp, i);
+				success = 0;
+				break;
+			}
+		}
+	}
+	if (quick_free != arena->nquick || quick_bytes != arena->quick_bytes)
+	{
+		printf("%ld QUICK BLOCKS OF %zu BYTES, %d OF %zu COUNTED \n",
+		       quick_free, quick_bytes, arena->nquick,
+		       arena->quick_bytes);
+		success = 0;
+	}
+
+	for (i = 0; i < seg_classes; i++)
+	{
+		if (!(ROOT(i) != NULL) != !(SL_BITMAP(i / SL_COUNT) &
+					     (1U << (i % SL_COUNT))))
+		{
+			printf("BITMAP OUT OF SYNC FOR CLASS %d \n", i);
+			success = 0;
+		}
+		if (!(SL_BITMAP(i / SL_COUNT)) !=
+		    !(FL_BITMAP & (1U << (i / SL_COUNT))))
+		{
+			printf("FIRST LEVEL BITMAP OUT OF SYNC FOR %d \n", i);
+			success = 0;
+		}
+		for (bp = ROOT(i); bp != NULL; bp = NEXT(bp))
+		{
+			list_free++;
+			list_bytes += GET_SIZE(HDRP(bp));
+			if (bp < mem_lo || bp > mem_hi)
+			{
+				printf("LIST BLOCK %p OUTSIDE HEAP \n", bp);
+				success = 0;
+				break;
+			}
+			if (GET_ALLOC(HDRP(bp)))
+			{
+				printf("ALLOCATED BLOCK %p ON FREE LIST \n", bp);
+				success = 0;
+			}
+			if (size_class(GET_SIZE(HDRP(bp))) != i)
+			{
+				printf("BLOCK %p ON LIST OF CLASS %d \n", bp, i);
+				success = 0;
+			}
+			if (NEXT(bp) != 0 && PREV(NEXT(bp)) != bp)
+			{
+				printf("bp's NEXT DOESN'T POINT BACK %p \n", bp);
+				success = 0;
+			}
+			if (addr_order && NEXT(bp) != 0 && NEXT(bp) < (char *)bp)
+			{
+				printf("LIST OF CLASS %d OUT OF ORDER AT %p \n",
+				       i, bp);
+				success = 0;
+			}
+		}	
+	}
+#ifdef TREE_FIT
+	if (seg_classes > 1)
+	{
+		char *last = NULL;
+		if (!tree_check(arena->tree_root, &last, &list_free,
+				&list_bytes))
+			success = 0;
+	}
+#endif
+	if (heap_free != list_free)
+	{
+		printf("%ld FREE BLOCKS IN HEAP, %ld ON LISTS \n",
+		       heap_free, list_free);
+		success = 0;
+	}
+	if (list_bytes != arena->free_bytes)
+	{
+		printf("%zu FREE BYTES ON LISTS, %zu COUNTED \n",
+		       list_bytes, arena->free_bytes);
+		success = 0;
+	}
+
+	if (!success)
+	{
+	        printf("HEAP STARTS AT %p \n", (void *)arena->heap_p);
+	        printf("HEAP SIZE: %zu bytes \n", heapsize);
+	        printf("mem_lo = %p \n", mem_lo);
+	        printf("mem_hi = %p \n", mem_hi);
+	
+		for (bp = NEXT_BLKP(arena->heap_p); GET_SIZE(HDRP(bp)) > 0;
+						 bp = NEXT_BLKP(bp))
+		{
+			block_data(bp);
+		}
+	}
+	return success;
+}
+
+#ifdef TREE_FIT
+/*
+ * tree_check - walks tree t in order, counting its blocks and bytes;
+ *     returns 0 if it meets an allocated, small or out of order block
+ */
+static int tree_check(char *t, char **last, long *count, size_t *bytes)
+{
+	int ok = 1;
+
+	if (t == NULL)
+		return 1;
+	ok &= tree_check(LEFT(t), last, count, bytes);
+	if (GET_ALLOC(HDRP(t)) || !IN_TREE(GET_SIZE(HDRP(t))) ||
+	    (*last && tree_cmp(GET_SIZE(HDRP(*last)), *last, t) >= 0))
+	{
+		printf("TREE BLOCK %p OUT OF PLACE \n", t);
+		ok = 0;
+	}
+	*last = t;
+	(*count)++;
+	*bytes += GET_SIZE(HDRP(t));
+	ok &= tree_check(RIGHT(t), last, count, bytes);
+	return ok;
+}
+#endif
+
+static void block_data(void *bp)
+{
+	printf("-- Block data \n");
+	int hsize, halloc;
+	hsize = GET_SIZE(HDRP(bp));
+	halloc = GET_ALLOC(HDRP(bp));
+	if (halloc)
+	{
+		printf("ALLOCATED BLOCK: %p \n", (void *)bp);
+		printf("Size: %i bytes \n", hsize);
+		
+	}
+	else
+	{
+		printf("FREE BLOCK: %p \n", (void *)bp);
+		printf("Size: %i bytes \n", hsize);
+		printf("Next: %p \n", (void *)(NEXT(bp)));
+		printf("Prev: %p \n", (void *)(PREV(bp)));
+	}
+	printf("@@@@@@@@@@ \n");
+}
+#endif
@@ -3,7 +3,65 @@
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
+extern void mm_free_sized(void *ptr, size_t size); /* size last asked for */
 extern void *mm_realloc(void *ptr, size_t size);
+extern int mm_setopt(int param, int value);
+
+/* n blocks of one size at once; mm_free_batch sorts ptrs by address */
+extern int mm_malloc_batch(size_t size, int n, void **out);
+extern void mm_free_batch(void **ptrs, int n);
+
+/* Regions: objects bump-allocated from big blocks and freed all at
+ * once by mm_region_reset or mm_region_destroy. A region is not
+ * thread-safe; it belongs to the thread using it. */
+typedef struct mm_region mm_region_t;
+extern mm_region_t *mm_region_create(void);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+
+/* Heap counters, kept only when mm.c is built with -DMM_STATS; without
+ * it mm_stats returns 0. Reads taken while other threads allocate are
+ * approximate. */
+#define MM_STAT_CLASSES 160  /* free list size classes */
+typedef struct {
+	size_t live_bytes;	/* in allocated blocks, slab slots and regions */
+	size_t free_bytes;	/* in free heap blocks, quick lists included */
+	size_t largest_free;	/* biggest free heap block */
+	double fragmentation;	/* 1 - largest_free / free_bytes */
+	long free_blocks[MM_STAT_CLASSES]; /* free heap blocks per class */
+	long sbrks;		/* times a heap grew */
+	long splits;		/* free blocks split to fit a request */
+	long merges;		/* free neighbours merged into a freed block */
+	long fits;		/* free list searches... */
+	long fit_steps;		/* ... and the list blocks they looked at */
+	long quick_hits;	/* requests served from a quick list */
+	long quick_flushes;	/* times the quick lists were merged */
+} mm_stats_t;
+extern int mm_stats(mm_stats_t *st);
+
+/* 
+ * Options for mm_setopt(), which take effect at the next mm_init()
+ */
+#define MM_SEGLISTS 1  /* 1 = segregated size classes (default), 0 = one list */
+#define MM_SLAB     2  /* largest request served from slabs, 0..64 (64) */
+#define MM_ARENAS   3  /* arenas the heap is split into, 1..16 (1) */
+#define MM_TRIM     4  /* free blocks this big go back to memlib, 0 = never (128K) */
+#define MM_MMAP     5  /* requests this big get their own region, 0 = never,
+			  else above 64 (256K) */
+#define MM_QUICK    6  /* freed requests this big wait on quick lists, 0..512 (0) */
+#define MM_FIT      7  /* how a free block is chosen, an MM_FIT_* (MM_FIT_GOOD) */
+#define MM_ORDER    8  /* order of the free lists, an MM_ORDER_* (MM_ORDER_LIFO) */
+#define MM_SPLIT    9  /* smallest remainder split off, 0 = a minimum block (0) */
+#define MM_CHUNK   10  /* smallest heap growth step, 1..16K bytes (256) */
+
+/* Values of MM_FIT and MM_ORDER */
+#define MM_FIT_GOOD   0  /* head of a class whose blocks all fit, in O(1) */
+#define MM_FIT_FIRST  1  /* first block that fits, own class first */
+#define MM_FIT_NEXT   2  /* first fit from where the last search stopped */
+#define MM_FIT_BEST   3  /* smallest block that fits */
+#define MM_ORDER_LIFO 0  /* a freed block goes first on its list */
+#define MM_ORDER_ADDR 1  /* the lists are sorted by address */
 
 
 /* 
@@ -21,3 +79,6 @@ typedef struct {
 
 extern team_t team;
 
+/* mm_realloc calls since the last mm_init that did not copy the data */
+extern long mm_copies_avoided;
+
@@ -0,0 +1,437 @@
+/*
+ * mmtrace.c - an LD_PRELOAD shim that records the malloc, calloc,
+ *     realloc and free calls of a real program as a trace that
+ *     mdriver can replay:
+ *
+ *	unix> make mmtrace.so
+ *	unix> LD_PRELOAD=./mmtrace.so MMTRACE=app ./app
+ *	unix> mdriver -V -f app.<pid>.rep
+ *
+ * Each thread appends raw events (type, pointer, size, sequence
+ * number) to buffers of its own and never takes a lock; the only
+ * write the threads share is the atomic add that hands out sequence
+ * numbers. When the program exits, the events are put back in
+ * sequence order, pointers are turned into trace ids, and the trace
+ * is written in the .rep format that read_trace reads (mdriver -w
+ * turns it into the binary format).
+ *
+ * Frees of pointers the shim never saw (from memalign, say, or from
+ * before it was loaded) are left out, so the trace always replays.
+ */
+#define _GNU_SOURCE  /* for RTLD_NEXT */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define CHUNK_EVENTS (1<<14) /* events in one per-thread buffer */
+#define BOOT_BYTES   4096    /* for dlsym's callocs before we can pass them on */
+#define TOMB ((void *)1)     /* a removed slot of the pointer table */
+
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define TLS __thread __attribute__((tls_model("initial-exec")))
+
+/* Event types; NONE marks a slot that was never filled in */
+enum {NONE, ALLOC, FREE, REALLOC};
+
+/* One recorded call; id is filled in when the trace is written */
+typedef struct {
+    unsigned long seq;   /* position in the program-wide order */
+    void *ptr;           /* block returned (ALLOC, REALLOC) or freed */
+    void *old;           /* block passed to realloc */
+    size_t size;         /* requested size */
+    int type;
+    int id;
+} event_t;
+
+/* A buffer of events owned by one thread */
+typedef struct chunk {
+    struct chunk *next;  /* all chunks, newest first */
+    int count;           /* events filled in so far */
+    event_t ev[CHUNK_EVENTS];
+} chunk_t;
+
+/* A slot of the pointer-to-id table */
+typedef struct {
+    void *ptr;
+    int id;
+    size_t size;
+} slot_t;
+
+/* The functions we pass the calls on to */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+static char boot[BOOT_BYTES];   /* handed out while resolving the above */
+static size_t boot_used;
+
+static chunk_t *chunks;         /* every thread's buffers */
+static unsigned long next_seq;  /* next sequence number */
+static int done;                /* set once we stop recording */
+
+static TLS chunk_t *cur;        /* this thread's current buffer */
+static TLS int busy;            /* inside the shim; don't record */
+
+/* The pointer table used while writing the trace */
+static slot_t *table;
+static size_t table_cap, table_used;
+
+/*
+ * new_chunk - map a fresh buffer for this thread and push it on the
+ *     list of all chunks
+ */
+static chunk_t *new_chunk(void)
+{
+    chunk_t *c;
+
+    c = mmap(NULL, sizeof(chunk_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED)
+	return NULL;
+    c->next = __atomic_load_n(&chunks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&chunks, &c->next, c, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    return c;
+}
+
+/*
+ * reserve - take the next slot of this thread's buffer, and the event's
+ *     place in the program-wide order, before the call it records is
+ *     made; the slot stays NONE until fill. NULL if not recording.
+ */
+static event_t *reserve(void)
+{
+    event_t *e;
+
+    if (busy || __atomic_load_n(&done, __ATOMIC_RELAXED))
+	return NULL;
+    if (cur == NULL || cur->count == CHUNK_EVENTS) {
+	if ((cur = new_chunk()) == NULL)
+	    return NULL;
+    }
+    e = &cur->ev[cur->count];
+    e->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    e->type = NONE;
+    __atomic_store_n(&cur->count, cur->count + 1, __ATOMIC_RELEASE);
+    return e;
+}
+
+/*
+ * fill - complete the event in a slot from reserve
+ */
+static void fill(event_t *e, int type, void *ptr, void *old, size_t size)
+{
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    __atomic_store_n(&e->type, type, __ATOMIC_RELEASE);
+}
+
+/*
+ * record - append one event to this thread's buffer
+ */
+static void record(int type, void *ptr, void *old, size_t size)
+{
+    event_t *e;
+
+    if ((e = reserve()) != NULL)
+	fill(e, type, ptr, old, size);
+}
+
+/*
+ * resolve - look up the functions the shim stands in front of
+ */
+static void resolve(void)
+{
+    busy++;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    busy--;
+}
+
+/*
+ * boot_alloc - zeroed memory for calls made while resolve runs
+ */
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_BYTES)
+	return NULL;
+    p = boot + boot_used;
+    boot_used += size;
+    return p;
+}
+
+#define IN_BOOT(p) ((char *)(p) >= boot && (char *)(p) < boot + BOOT_BYTES)
+
+/*********************************************
+ * The interposed malloc, calloc, realloc, free
+ *********************************************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && !busy)
+	resolve();
+    if (real_malloc == NULL)
+	return boot_alloc(size);  /* dlsym itself, from resolve */
+    if ((p = real_malloc(size)) != NULL)
+	record(ALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL && !busy)
+	resolve();
+    if (real_calloc == NULL)
+	return boot_alloc(n * size);  /* dlsym itself, from resolve */
+    if ((p = real_calloc(n, size)) != NULL)
+	record(ALLOC, p, NULL, n * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    event_t *e;
+    void *p;
+
+    if (real_realloc == NULL && !busy)
+	resolve();
+    if (IN_BOOT(ptr)) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, MIN(size, (size_t)(boot + BOOT_BYTES - (char *)ptr)));
+	return p;
+    }
+    if (ptr != NULL && size == 0) {  /* this realloc is a free */
+	record(FREE, ptr, NULL, 0);
+	return real_realloc(ptr, size);
+    }
+    /* 
+     * In its place before the call, as a free is; once the old block is
+     * released inside real_realloc, another thread's malloc may get it.
+     * A failed realloc leaves its slot NONE.
+     */
+    e = reserve();
+    if ((p = real_realloc(ptr, size)) != NULL && e != NULL)
+	fill(e, ptr ? REALLOC : ALLOC, p, ptr, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || IN_BOOT(ptr))
+	return;
+    if (real_free == NULL)
+	resolve();
+    /* Before the block goes, so a malloc that reuses it comes later */
+    record(FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+/************************************************
+ * Turning the events into a trace when we exit
+ ************************************************/
+
+/*
+ * slot_of - the table slot holding ptr, or the free one it would go in
+ */
+static slot_t *slot_of(void *ptr)
+{
+    size_t h = (size_t)ptr >> 4;
+    slot_t *tomb = NULL;
+
+    h ^= h >> 16;
+    h *= (size_t)0x9E3779B97F4A7C15ULL;
+    for (h &= table_cap - 1; table[h].ptr != NULL; h = (h + 1) & (table_cap - 1)) {
+	if (table[h].ptr == ptr)
+	    return &table[h];
+	if (table[h].ptr == TOMB && tomb == NULL)
+	    tomb = &table[h];
+    }
+    return tomb ? tomb : &table[h];
+}
+
+/*
+ * grow_table - rehash once the table is half full, into one twice the
+ *     size unless it was mostly removed slots
+ */
+static int grow_table(void)
+{
+    slot_t *old = table, *s;
+    size_t i, live = 0, old_cap = table_cap;
+
+    for (i = 0; i < old_cap; i++)
+	live += old[i].ptr != NULL && old[i].ptr != TOMB;
+    table_cap = old_cap == 0 ? 1024 : 4 * live < old_cap ? old_cap : 2 * old_cap;
+    table = mmap(NULL, table_cap * sizeof(slot_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED)
+	return -1;
+    table_used = 0;
+    for (i = 0; i < old_cap; i++) {
+	if (old[i].ptr != NULL && old[i].ptr != TOMB) {
+	    s = slot_of(old[i].ptr);
+	    *s = old[i];
+	    table_used++;
+	}
+    }
+    if (old)
+	munmap(old, old_cap * sizeof(slot_t));
+    return 0;
+}
+
+/*
+ * write_events - give each event its trace id, dropping the ones that
+ *     cannot be replayed, and write the trace out as a .rep file
+ */
+static void write_events(event_t *ev, unsigned long n, FILE *fp)
+{
+    unsigned long i, ops = 0;
+    size_t live = 0, peak = 0;
+    int ids = 0;
+    slot_t *s;
+    event_t *e;
+
+    for (i = 0; i < n; i++) {
+	e = &ev[i];
+	if (e->type == NONE)
+	    continue;
+	if (e->size > INT_MAX) {  /* too big for a trace; leave it out */
+	    if (e->type == ALLOC) {
+		e->type = NONE;
+		continue;
+	    }
+	    if (e->type == REALLOC) {
+		e->type = FREE;   /* its later free is then left out too */
+		e->ptr = e->old;
+	    }
+	}
+	if (e->size == 0 && e->type != FREE)
+	    e->size = 1;          /* mm_malloc(0) would return NULL */
+	if (e->type == REALLOC || e->type == FREE) {
+	    s = slot_of(e->type == FREE ? e->ptr : e->old);
+	    if (s->ptr == NULL || s->ptr == TOMB) {
+		/* Never saw this block; a realloc of it starts a new one */
+		if (e->type == FREE) {
+		    e->type = NONE;
+		    continue;
+		}
+		e->type = ALLOC;
+	    } else {
+		e->id = s->id;
+		live -= s->size;
+		s->ptr = TOMB;
+		if (e->type == FREE) {
+		    ops++;
+		    continue;
+		}
+	    }
+	}
+	if (e->ptr == NULL)
+	    continue;
+	if ((table_used + 1) * 2 > table_cap && grow_table() < 0)
+	    return;
+	s = slot_of(e->ptr);
+	if (s->ptr == NULL)
+	    table_used++;
+	else if (s->ptr != TOMB)
+	    live -= s->size;      /* a lost free; the old id just stays live */
+	if (e->type == ALLOC)
+	    e->id = ids++;
+	s->ptr = e->ptr;
+	s->id = e->id;
+	s->size = e->size;
+	live += e->size;
+	peak = MAX(peak, live);
+	ops++;
+    }
+
+    fprintf(fp, "%lu\n%d\n%lu\n%d\n", (unsigned long)peak, ids, ops, 1);
+    for (i = 0; i < n; i++) {
+	e = &ev[i];
+	if (e->type == ALLOC)
+	    fprintf(fp, "a %d %lu\n", e->id, (unsigned long)e->size);
+	else if (e->type == REALLOC)
+	    fprintf(fp, "r %d %lu\n", e->id, (unsigned long)e->size);
+	else if (e->type == FREE)
+	    fprintf(fp, "f %d\n", e->id);
+    }
+}
+
+/*
+ * mmtrace_fini - stop recording, put the events of all threads in
+ *     order, and write the trace to <$MMTRACE or mmtrace>.<pid>.rep
+ */
+static void __attribute__((destructor)) mmtrace_fini(void)
+{
+    unsigned long n, i;
+    event_t *ev;
+    chunk_t *c;
+    char path[PATH_MAX];
+    char *name;
+    FILE *fp;
+    int count;
+
+    busy++;
+    __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+    n = __atomic_load_n(&next_seq, __ATOMIC_RELAXED);
+    if (n == 0)
+	return;
+
+    /* Sequence numbers are dense, so each event goes straight to its place */
+    ev = mmap(NULL, n * sizeof(event_t), PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ev == MAP_FAILED) {
+	fprintf(stderr, "mmtrace: no memory for %lu events\n", n);
+	return;
+    }
+    for (c = __atomic_load_n(&chunks, __ATOMIC_ACQUIRE); c; c = c->next) {
+	count = __atomic_load_n(&c->count, __ATOMIC_ACQUIRE);
+	for (i = 0; i < (unsigned long)count; i++)
+	    if (c->ev[i].seq < n)
+		ev[c->ev[i].seq] = c->ev[i];
+    }
+
+    if ((name = getenv("MMTRACE")) == NULL)
+	name = "mmtrace";
+    snprintf(path, sizeof(path), "%s.%d.rep", name, (int)getpid());
+    if ((fp = fopen(path, "w")) == NULL) {
+	perror(path);
+	return;
+    }
+    if (grow_table() == 0)
+	write_events(ev, n, fp);
+    fclose(fp);
+}
+
+/*
+ * mmtrace_child - a forked child records nothing; the events so far
+ *     belong to the parent, which writes them
+ */
+static void mmtrace_child(void)
+{
+    done = 1;
+}
+
+static void __attribute__((constructor)) mmtrace_init(void)
+{
+    if (real_malloc == NULL)
+	resolve();
+    pthread_atfork(NULL, NULL, mmtrace_child);
+}